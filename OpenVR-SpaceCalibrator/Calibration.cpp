@@ -2,13 +2,18 @@
 #include "Configuration.h"
 #include "IPCClient.h"
 #include "CalibrationCalc.h"
+#include "CalibrationMetrics.h"
+#include "DeviceRegistry.h"
+#include "PoseSampler.h"
+#include "ProfileStore.h"
 
 #include <string>
 #include <vector>
 #include <iostream>
 
 #include <Eigen/Dense>
-#include <GLFW/glfw3.h>
+#include <chrono>
+#include <cmath>
 
 
 inline vr::HmdQuaternion_t operator*(const vr::HmdQuaternion_t& lhs, const vr::HmdQuaternion_t& rhs) {
@@ -71,6 +76,91 @@ static IPCClient Driver;
 CalibrationContext CalCtx;
 static CalibrationCalc calibration;
 static protocol::DriverPoseShmem shmem;
+static protocol::DeviceTransformShmem transformTable;
+static PoseSampler sampler;
+
+// Minimum spacing between calibration samples, in seconds.
+static const double SampleInterval = 0.05;
+
+// Samples collected for the current calibration, alongside the solver's own window
+static std::vector<Sample> samples;
+
+// Keyframes the solver resumed with, or 0 after a cold start. Until the window has filled once, a
+// resumed solver computes as soon as WarmStartSamples fresh samples join its keyframes, provided
+// those samples alone confirm the resumed estimate.
+static size_t warmStartKeyframes = 0;
+static const size_t WarmStartSamples = 10;
+
+// Mirror of the transforms the driver currently applies, so scans only send what changed.
+static struct DriverTransformShadow
+{
+	bool valid[vr::k_unMaxTrackedDeviceCount] = {};
+	protocol::DeviceTransformState transforms[vr::k_unMaxTrackedDeviceCount];
+	bool alignmentSpeedParamsValid = false;
+	protocol::AlignmentSpeedParams alignmentSpeedParams;
+} driverShadow;
+
+// Everything a profile scan depends on besides the driver's state. Devices are covered by the
+// registry generation, which changes whenever a slot's class, tracking system or serial does.
+struct ScanInputs
+{
+	uint64_t devicesGeneration = 0;
+	bool validProfile = false, continuous = false, quashTarget = false;
+	int32_t targetID = -1;
+	int quashForwardInterval = 0;
+	Eigen::Vector3d rotation, translation;
+	double scale = 1.0;
+	std::string referenceTrackingSystem, targetTrackingSystem;
+	protocol::AlignmentSpeedParams alignmentSpeedParams;
+
+	static ScanInputs FromContext(const CalibrationContext &ctx)
+	{
+		ScanInputs inputs;
+		inputs.devicesGeneration = Devices.Generation();
+		inputs.validProfile = ctx.validProfile;
+		inputs.continuous = ctx.state == CalibrationState::Continuous;
+		inputs.quashTarget = ctx.quashTargetInContinuous;
+		inputs.targetID = ctx.targetID;
+		inputs.quashForwardInterval = ctx.quashTargetForwardInterval;
+		inputs.rotation = ctx.calibratedRotation;
+		inputs.translation = ctx.calibratedTranslation;
+		inputs.scale = ctx.calibratedScale;
+		inputs.referenceTrackingSystem = ctx.referenceTrackingSystem;
+		inputs.targetTrackingSystem = ctx.targetTrackingSystem;
+		inputs.alignmentSpeedParams = ctx.alignmentSpeedParams;
+		return inputs;
+	}
+
+	bool operator==(const ScanInputs &other) const
+	{
+		return devicesGeneration == other.devicesGeneration
+			&& validProfile == other.validProfile
+			&& continuous == other.continuous
+			&& quashTarget == other.quashTarget
+			&& targetID == other.targetID
+			&& quashForwardInterval == other.quashForwardInterval
+			&& rotation == other.rotation
+			&& translation == other.translation
+			&& scale == other.scale
+			&& referenceTrackingSystem == other.referenceTrackingSystem
+			&& targetTrackingSystem == other.targetTrackingSystem
+			&& memcmp(&alignmentSpeedParams, &other.alignmentSpeedParams, sizeof(alignmentSpeedParams)) == 0;
+	}
+};
+
+// Result of the last full scan. While its inputs are unchanged and nothing else touched the
+// driver's transforms, a scan only has to restore ctx.enabled.
+static struct ScanCache
+{
+	bool valid = false;
+	ScanInputs inputs;
+	bool enabled = false;
+} scanCache;
+
+// Differences below these are treated as "already applied".
+static const double TranslationEpsilon = 1e-6; // meters
+static const double RotationEpsilon = 1e-12; // 1 - |q1.q2|
+static const double ScaleEpsilon = 1e-9;
 
 namespace {
 	// Simplified AssignTargets for Linux - validates current device IDs
@@ -92,10 +182,85 @@ namespace {
 	}
 }
 
-void InitCalibrator()
+// Loads the driver's current transform table, e.g. when reconnecting to a driver that is
+// still applying a calibration from a previous session.
+void ResyncDriverTransforms()
+{
+	protocol::Response response;
+	auto &table = response.deviceTransforms;
+
+	if (transformTable)
+	{
+		transformTable.ReadTable(table);
+	}
+	else
+	{
+		response = Driver.SendBlocking(protocol::Request(protocol::RequestGetDeviceTransforms));
+		if (response.type != protocol::ResponseDeviceTransforms)
+		{
+			std::cerr << "Could not read driver transforms, will resend all" << std::endl;
+			driverShadow = DriverTransformShadow();
+			scanCache.valid = false;
+			return;
+		}
+	}
+
+	for (uint32_t id = 0; id < vr::k_unMaxTrackedDeviceCount; ++id)
+	{
+		driverShadow.transforms[id] = table.transforms[id];
+		driverShadow.valid[id] = true;
+	}
+	driverShadow.alignmentSpeedParams = table.alignmentSpeedParams;
+	driverShadow.alignmentSpeedParamsValid = true;
+	scanCache.valid = false;
+}
+
+// Hands transforms to the driver. With the shared transform table this is a plain memory write
+// the pose hooks pick up on their next update; the socket is only used if the table is missing.
+static void SendDeviceTransforms(const protocol::Request &req)
+{
+	const auto &batch = req.setDeviceTransformBatch;
+	if (transformTable)
+	{
+		transformTable.Publish([&](protocol::DeviceTransformTable &table) {
+			table.alignmentSpeedParams = batch.alignmentSpeedParams;
+			for (uint32_t i = 0; i < batch.count; ++i)
+				protocol::ApplyDeviceTransform(table.transforms[batch.transforms[i].openVRID], batch.transforms[i]);
+		});
+		return;
+	}
+
+	// The reply is only an acknowledgement, let the next tick collect it
+	Driver.SendAsync(req);
+	Driver.Flush();
+}
+
+// Pose hook timings since the previous request; the callback runs from a later CalibrationTick
+void RequestDriverStats(std::function<void(const protocol::DriverStats &)> callback)
+{
+	Driver.SendAsync(protocol::Request(protocol::RequestGetDriverStats), [callback](const protocol::Response &response) {
+		if (response.type == protocol::ResponseDriverStats)
+			callback(response.driverStats);
+	});
+	Driver.Flush();
+}
+
+double CalibrationClock()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+void InitCalibrator(std::function<void()> onSample)
 {
 	Driver.Connect();
 
+	// Opened after the handshake, so the table belongs to a driver speaking our protocol version
+	if (!transformTable.Open(OPENVR_SPACECALIBRATOR_TRANSFORM_SHMEM_NAME)) {
+		std::cout << "Warning: Could not open transform shared memory. Will send transforms over IPC." << std::endl;
+	}
+	ResyncDriverTransforms();
+
 	// Open shared memory for reading driver poses
 	if (!shmem.Open(OPENVR_SPACECALIBRATOR_SHMEM_NAME)) {
 		std::cout << "Warning: Could not open pose shared memory. Will fall back to VR API." << std::endl;
@@ -103,6 +268,9 @@ void InitCalibrator()
 		std::cout << "Successfully opened pose shared memory" << std::endl;
 	}
 
+	// Wakes the main loop as soon as the sampler thread captures a pair
+	sampler.Start(onSample);
+
 	// Initialize driver pose array
 	memset(CalCtx.driverPoses, 0, sizeof(CalCtx.driverPoses));
 }
@@ -265,15 +433,8 @@ Eigen::Vector3d CalibrateTranslation(const std::vector<Sample> &samples)
 	return transcm;
 }
 
-Sample CollectSample(const CalibrationContext &ctx)
+Sample CollectSample(const CalibrationContext &ctx, vr::DriverPose_t reference, vr::DriverPose_t target, double time)
 {
-	vr::DriverPose_t reference, target;
-	reference.poseIsValid = false;
-	target.poseIsValid = false;
-
-	reference = ctx.driverPoses[ctx.referenceID];
-	target = ctx.driverPoses[ctx.targetID];
-
 	bool ok = true;
 	if (!reference.poseIsValid)
 	{
@@ -303,10 +464,34 @@ Sample CollectSample(const CalibrationContext &ctx)
 	return Sample(
 		ConvertPose(reference),
 		ConvertPose(target),
-		glfwGetTime()
+		time
 	);
 }
 
+// Gathers the samples taken since the last tick: the pairs captured by the sampler thread when
+// it is available, otherwise the latest driver poses read on this tick.
+void CollectSamples(const CalibrationContext &ctx, std::vector<Sample> &out)
+{
+	if (!sampler.IsRunning())
+	{
+		auto sample = CollectSample(ctx, ctx.driverPoses[ctx.referenceID], ctx.driverPoses[ctx.targetID], CalibrationClock());
+		if (sample.valid)
+			out.push_back(sample);
+		return;
+	}
+
+	sampler.Collect(ctx.referenceID, ctx.targetID, SampleInterval);
+
+	PoseSampler::PosePair pair;
+	while (sampler.PopSample(pair))
+	{
+		auto sample = CollectSample(ctx, pair.reference, pair.target, pair.time);
+		if (!sample.valid)
+			break;
+		out.push_back(sample);
+	}
+}
+
 vr::HmdQuaternion_t VRRotationQuat(Eigen::Vector3d eulerdeg)
 {
 	auto euler = eulerdeg * EIGEN_PI / 180.0;
@@ -334,7 +519,7 @@ vr::HmdVector3d_t VRTranslationVec(Eigen::Vector3d transcm)
 	return vrTrans;
 }
 
-void ResetAndDisableOffsets(uint32_t id)
+protocol::SetDeviceTransform DisabledTransform(uint32_t id)
 {
 	vr::HmdVector3d_t zeroV;
 	zeroV.v[0] = zeroV.v[1] = zeroV.v[2] = 0;
@@ -342,54 +527,163 @@ void ResetAndDisableOffsets(uint32_t id)
 	vr::HmdQuaternion_t zeroQ;
 	zeroQ.x = 0; zeroQ.y = 0; zeroQ.z = 0; zeroQ.w = 1;
 
-	protocol::Request req(protocol::RequestSetDeviceTransform);
-	req.setDeviceTransform = { id, false, zeroV, zeroQ, 1.0 };
-	Driver.SendBlocking(req);
+	return { id, false, zeroV, zeroQ, 1.0 };
+}
+
+bool TransformChanged(uint32_t id, const protocol::SetDeviceTransform &next)
+{
+	if (!driverShadow.valid[id])
+		return true;
+
+	const auto &current = driverShadow.transforms[id];
+	if (current.enabled != next.enabled)
+		return true;
+
+	// Offsets of disabled devices are never applied, so their values don't matter
+	if (!next.enabled)
+		return false;
+
+	if (current.lerp != next.lerp || current.quash != next.quash || current.quashForwardInterval != next.quashForwardInterval)
+		return true;
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (std::abs(current.translation.v[i] - next.translation.v[i]) > TranslationEpsilon)
+			return true;
+	}
+
+	double dot =
+		current.rotation.w * next.rotation.w + current.rotation.x * next.rotation.x +
+		current.rotation.y * next.rotation.y + current.rotation.z * next.rotation.z;
+	if (1.0 - std::abs(dot) > RotationEpsilon)
+		return true;
+
+	return std::abs(current.scale - next.scale) > ScaleEpsilon;
+}
+
+void RecordSentTransform(const protocol::SetDeviceTransform &tf)
+{
+	driverShadow.transforms[tf.openVRID] = { tf.enabled, tf.translation, tf.rotation, tf.scale, tf.lerp, tf.quash, tf.quashForwardInterval };
+	driverShadow.valid[tf.openVRID] = true;
+}
+
+void ResetAndDisableOffsets(uint32_t id)
+{
+	protocol::Request req(protocol::RequestSetDeviceTransformBatch);
+	auto &batch = req.setDeviceTransformBatch;
+	batch.alignmentSpeedParams = CalCtx.alignmentSpeedParams;
+	batch.count = 1;
+	batch.transforms[0] = DisabledTransform(id);
+	SendDeviceTransforms(req);
+	RecordSentTransform(batch.transforms[0]);
+	scanCache.valid = false;
 }
 
 static_assert(vr::k_unTrackedDeviceIndex_Hmd == 0, "HMD index expected to be 0");
 
+// Re-applies the saved chaperone if SteamVR replaced it, e.g. after a room setup reset
+static void ApplyChaperoneIfReset(const CalibrationContext &ctx)
+{
+	if (ctx.enabled && ctx.chaperone.valid && ctx.chaperone.autoApply)
+	{
+		uint32_t quadCount = 0;
+		vr::VRChaperoneSetup()->GetLiveCollisionBoundsInfo(nullptr, &quadCount);
+
+		// Heuristic: when SteamVR resets to a blank-ish chaperone, it uses empty geometry,
+		// but manual adjustments (e.g. via a play space mover) will not touch geometry.
+		if (quadCount != ctx.chaperone.geometry.size())
+		{
+			ApplyChaperoneBounds();
+		}
+	}
+}
+
+// Device set SelectStoredProfile last looked at, or ~0 to look again on the next scan
+static uint64_t checkedGeneration = ~0ull;
+
+void RecheckStoredProfile()
+{
+	checkedGeneration = ~0ull;
+}
+
+// Switches to the stored calibration for the connected devices when the one in use was made with
+// devices that are gone. Checked only when the device set changes, and never mid-calibration.
+static void SelectStoredProfile(CalibrationContext &ctx)
+{
+	uint64_t generation = Devices.Generation();
+	if (ctx.state != CalibrationState::None || generation == checkedGeneration)
+		return;
+	checkedGeneration = generation;
+
+	// Calibrations made before serials were recorded stay in use, as they always did
+	auto activeKey = ProfileKey::FromContext(ctx);
+	if (ctx.validProfile && !activeKey.HasSerials())
+		return;
+
+	auto match = Profiles.Match(Devices.State(), activeKey);
+	if (!match || (ctx.validProfile && match->key == activeKey))
+		return;
+
+	match->ApplyTo(ctx);
+	CalCtx.Log("Using the stored calibration for " + match->key.referenceSerial + " (" + match->key.referenceTrackingSystem + ") and "
+		+ match->key.targetSerial + " (" + match->key.targetTrackingSystem + ")\n");
+	SaveProfile(ctx);
+}
+
 void ScanAndApplyProfile(CalibrationContext &ctx)
 {
-	char buffer[vr::k_unMaxPropertyStringSize];
+	SelectStoredProfile(ctx);
+
+	auto inputs = ScanInputs::FromContext(ctx);
+	if (scanCache.valid && scanCache.inputs == inputs)
+	{
+		ctx.enabled = scanCache.enabled;
+		ApplyChaperoneIfReset(ctx);
+		return;
+	}
+
 	ctx.enabled = ctx.validProfile;
 
-	// Send alignment speed parameters to driver for smooth interpolation
-	protocol::Request setParamsReq(protocol::RequestSetAlignmentSpeedParams);
-	setParamsReq.setAlignmentSpeedParams = ctx.alignmentSpeedParams;
-	Driver.SendBlocking(setParamsReq);
+	// All transforms and the alignment speed parameters go to the driver in a single update,
+	// containing only the entries that differ from what the driver already has.
+	protocol::Request req(protocol::RequestSetDeviceTransformBatch);
+	auto &batch = req.setDeviceTransformBatch;
+	batch.alignmentSpeedParams = ctx.alignmentSpeedParams;
+	batch.count = 0;
+
+	auto queue = [&](const protocol::SetDeviceTransform &transform) {
+		if (TransformChanged(transform.openVRID, transform))
+			batch.transforms[batch.count++] = transform;
+	};
 
 	for (uint32_t id = 0; id < vr::k_unMaxTrackedDeviceCount; ++id)
 	{
-		auto deviceClass = vr::VRSystem()->GetTrackedDeviceClass(id);
-		if (deviceClass == vr::TrackedDeviceClass_Invalid)
+		auto device = Devices.Device(id);
+		if (!device)
 			continue;
 
-		/*if (deviceClass == vr::TrackedDeviceClass_HMD) // for debugging unexpected universe switches
+		/*if (device->deviceClass == vr::TrackedDeviceClass_HMD) // for debugging unexpected universe switches
 		{
 			vr::ETrackedPropertyError err = vr::TrackedProp_Success;
 			auto universeId = vr::VRSystem()->GetUint64TrackedDeviceProperty(id, vr::Prop_CurrentUniverseId_Uint64, &err);
 			printf("uid %d err %d\n", universeId, err);
-			ResetAndDisableOffsets(id);
+			queue(DisabledTransform(id));
 			continue;
 		}*/
 
 		if (!ctx.enabled)
 		{
-			ResetAndDisableOffsets(id);
+			queue(DisabledTransform(id));
 			continue;
 		}
 
-		vr::ETrackedPropertyError err = vr::TrackedProp_Success;
-		vr::VRSystem()->GetStringTrackedDeviceProperty(id, vr::Prop_TrackingSystemName_String, buffer, vr::k_unMaxPropertyStringSize, &err);
-
-		if (err != vr::TrackedProp_Success)
+		if (device->trackingSystem.empty())
 		{
-			ResetAndDisableOffsets(id);
+			queue(DisabledTransform(id));
 			continue;
 		}
 
-		std::string trackingSystem(buffer);
+		const std::string &trackingSystem = device->trackingSystem;
 
 		if (id == vr::k_unTrackedDeviceIndex_Hmd)
 		{
@@ -402,51 +696,59 @@ void ScanAndApplyProfile(CalibrationContext &ctx)
 				ctx.enabled = false;
 			}
 
-			ResetAndDisableOffsets(id);
+			queue(DisabledTransform(id));
 			continue;
 		}
 
 		if (trackingSystem != ctx.targetTrackingSystem)
 		{
-			ResetAndDisableOffsets(id);
+			queue(DisabledTransform(id));
 			continue;
 		}
 
-		protocol::Request req(protocol::RequestSetDeviceTransform);
-		req.setDeviceTransform = {
+		protocol::SetDeviceTransform transform(
 			id,
 			true,
 			VRTranslationVec(ctx.calibratedTranslation),
 			VRRotationQuat(ctx.calibratedRotation),
 			ctx.calibratedScale
-		};
+		);
 		// Enable lerp (smooth interpolation) for continuous calibration
-		req.setDeviceTransform.lerp = (CalCtx.state == CalibrationState::Continuous);
+		transform.lerp = (CalCtx.state == CalibrationState::Continuous);
 		// Quash target pose updates during continuous calibration if enabled
-		req.setDeviceTransform.quash = (CalCtx.state == CalibrationState::Continuous && id == CalCtx.targetID && CalCtx.quashTargetInContinuous);
-		Driver.SendBlocking(req);
+		transform.quash = (CalCtx.state == CalibrationState::Continuous && id == CalCtx.targetID && CalCtx.quashTargetInContinuous);
+		if (transform.quash)
+			transform.quashForwardInterval = (uint32_t) std::max(CalCtx.quashTargetForwardInterval, 0);
+		queue(transform);
 	}
 
-	if (ctx.enabled && ctx.chaperone.valid && ctx.chaperone.autoApply)
+	bool paramsChanged = !driverShadow.alignmentSpeedParamsValid ||
+		memcmp(&driverShadow.alignmentSpeedParams, &ctx.alignmentSpeedParams, sizeof(ctx.alignmentSpeedParams)) != 0;
+
+	if (batch.count > 0 || paramsChanged)
 	{
-		uint32_t quadCount = 0;
-		vr::VRChaperoneSetup()->GetLiveCollisionBoundsInfo(nullptr, &quadCount);
+		SendDeviceTransforms(req);
 
-		// Heuristic: when SteamVR resets to a blank-ish chaperone, it uses empty geometry,
-		// but manual adjustments (e.g. via a play space mover) will not touch geometry.
-		if (quadCount != ctx.chaperone.geometry.size())
-		{
-			ApplyChaperoneBounds();
-		}
+		for (uint32_t i = 0; i < batch.count; ++i)
+			RecordSentTransform(batch.transforms[i]);
+		driverShadow.alignmentSpeedParams = ctx.alignmentSpeedParams;
+		driverShadow.alignmentSpeedParamsValid = true;
 	}
+
+	scanCache.valid = true;
+	scanCache.inputs = std::move(inputs);
+	scanCache.enabled = ctx.enabled;
+
+	ApplyChaperoneIfReset(ctx);
 }
 
 void StartCalibration()
 {
 	CalCtx.state = CalibrationState::Begin;
-	CalCtx.wantedUpdateInterval = 0.0;
+	CalCtx.wantedUpdateInterval = sampler.IsRunning() ? SampleInterval : 0.0;
 	CalCtx.messages.clear();
 	calibration.Clear();
+	warmStartKeyframes = 0;
 }
 
 void StartContinuousCalibration()
@@ -460,6 +762,24 @@ void StartContinuousCalibration()
 	calibration.setRelativeTransformation(CalCtx.refToTargetPose, CalCtx.relativePosCalibrated);
 	calibration.lockRelativePosition = CalCtx.lockRelativePosition;
 
+	// Resume from the solver state of the last session with these devices
+	auto reference = Devices.Device(CalCtx.referenceID), target = Devices.Device(CalCtx.targetID);
+	auto stored = Profiles.Find(ProfileKey::FromContext(CalCtx));
+	if (CalCtx.validProfile && stored && !stored->solverState.keyframes.empty() && reference && target
+		&& reference->serial == CalCtx.referenceSerial && target->serial == CalCtx.targetSerial)
+	{
+		calibration.RestoreState(stored->solverState);
+		samples = stored->solverState.keyframes;
+		warmStartKeyframes = samples.size();
+
+		char buf[256];
+		if (std::isfinite(stored->solverState.priorError))
+			snprintf(buf, sizeof buf, "Resuming from %zu saved samples (error %.1f mm)\n", warmStartKeyframes, stored->solverState.priorError * 1000.0);
+		else
+			snprintf(buf, sizeof buf, "Resuming from %zu saved samples\n", warmStartKeyframes);
+		CalCtx.Log(buf);
+	}
+
 	if (CalCtx.lockRelativePosition) {
 		CalCtx.Log("Relative position locked\n");
 	}
@@ -467,7 +787,9 @@ void StartContinuousCalibration()
 		CalCtx.Log("Collecting initial samples...\n");
 	}
 
-	// Note: Metrics::WriteLogAnnotation not ported to Linux version
+	if (CalCtx.recordMetrics)
+		Metrics::StartLog();
+	Metrics::WriteLogAnnotation(CalCtx.lockRelativePosition ? "start continuous calibration (relative position locked)" : "start continuous calibration");
 }
 
 void EndContinuousCalibration()
@@ -476,7 +798,8 @@ void EndContinuousCalibration()
 	CalCtx.relativePosCalibrated = false;
 	SaveProfile(CalCtx);
 	CalCtx.Log("Continuous calibration stopped, profile saved\n");
-	// Note: Metrics::WriteLogAnnotation not ported to Linux version
+	Metrics::WriteLogAnnotation("end continuous calibration");
+	Metrics::StopLog();
 }
 
 void CalibrationTick(double time)
@@ -485,7 +808,7 @@ void CalibrationTick(double time)
 		return;
 
 	auto &ctx = CalCtx;
-	if ((time - ctx.timeLastTick) < 0.05)
+	if ((time - ctx.timeLastTick) < CalibrationTickInterval)
 		return;
 
 	// Handle continuous calibration clearing log messages
@@ -501,6 +824,26 @@ void CalibrationTick(double time)
 
 	ctx.timeLastTick = time;
 
+	// Writes the profile once the changes since the last save have settled, and picks up edits
+	// made to it by anything else
+	PollProfileSave(ctx, time);
+	PollProfileReload(ctx);
+
+	// Completes pipelined driver requests sent since the last tick
+	Driver.Poll();
+
+	// Picks up connected, disconnected and re-enumerated devices
+	Devices.PollEvents();
+
+	// The driver only writes poses for devices a live reader subscribed to
+	uint64_t subscribeMask = 0;
+	if (ctx.referenceID >= 0 && ctx.referenceID < (int32_t) vr::k_unMaxTrackedDeviceCount)
+		subscribeMask |= 1ull << ctx.referenceID;
+	if (ctx.targetID >= 0 && ctx.targetID < (int32_t) vr::k_unMaxTrackedDeviceCount)
+		subscribeMask |= 1ull << ctx.targetID;
+	shmem.Subscribe(subscribeMask);
+	shmem.Heartbeat();
+
 	// Read poses from shared memory (driver poses with proper transforms!)
 	shmem.ReadNewPoses([&](const protocol::DriverPoseShmem::AugmentedPose& augmented_pose) {
 		if (augmented_pose.deviceId >= 0 && augmented_pose.deviceId <= vr::k_unMaxTrackedDeviceCount) {
@@ -520,7 +863,9 @@ void CalibrationTick(double time)
 		// Skip if HMD is at origin or hasn't moved since last tick
 		if ((px == 0.0f && py == 0.0f && pz == 0.0f) ||
 		    (ctx.xprev == px && ctx.yprev == py && ctx.zprev == pz)) {
-			// HMD tracking didn't update, skip this tick to avoid bad samples
+			// HMD tracking didn't update, skip this tick to avoid bad samples, including the
+			// ones the sampler thread captured in the meantime
+			sampler.Discard();
 			return;
 		}
 
@@ -572,6 +917,11 @@ void CalibrationTick(double time)
 		}
 	}
 
+	if (ctx.state == CalibrationState::None || ctx.state == CalibrationState::Editing || ctx.state == CalibrationState::Begin)
+	{
+		sampler.StopCollecting();
+	}
+
 	if (ctx.state == CalibrationState::None)
 	{
 		ctx.wantedUpdateInterval = 1.0;
@@ -647,27 +997,54 @@ void CalibrationTick(double time)
 
 		ResetAndDisableOffsets(ctx.targetID);
 		ctx.state = CalibrationState::Rotation;
-		ctx.wantedUpdateInterval = 0.0;
+		ctx.wantedUpdateInterval = sampler.IsRunning() ? SampleInterval : 0.0;
 
 		CalCtx.Log("Starting calibration...\n");
 		return;
 	}
 
-	auto sample = CollectSample(ctx);
-	if (!sample.valid)
+	std::vector<Sample> newSamples;
+	CollectSamples(ctx, newSamples);
+	if (newSamples.empty())
 	{
 		return;
 	}
 
-	// Push sample to CalibrationCalc for continuous mode
-	calibration.PushSample(sample);
+	for (auto &sample : newSamples)
+	{
+		// Push sample to CalibrationCalc for continuous mode
+		calibration.PushSample(sample);
+		samples.push_back(sample);
+	}
+
+	// Once enough fresh samples are in, the resumed estimate has to hold on them alone; if it
+	// doesn't, the saved keyframes are stale and calibration starts over from the fresh samples.
+	if (calibration.RestoredKeyframes() > 0 && samples.size() >= warmStartKeyframes + WarmStartSamples)
+	{
+		if (calibration.ConfirmRestoredState())
+		{
+			CalCtx.Log("Saved solver state confirmed by new samples\n");
+		}
+		else
+		{
+			CalCtx.Log("Saved solver state does not match the new samples, starting over\n");
+			samples.erase(samples.begin(), samples.begin() + std::min(warmStartKeyframes, samples.size()));
+			warmStartKeyframes = 0;
+		}
+	}
 
-	static std::vector<Sample> samples;
-	samples.push_back(sample);
+	size_t requiredSamples = CalCtx.SampleCount();
+	if (warmStartKeyframes > 0)
+	{
+		if (calibration.SampleCount() >= requiredSamples)
+			warmStartKeyframes = 0;
+		else
+			requiredSamples = std::min(requiredSamples, warmStartKeyframes + WarmStartSamples);
+	}
 
-	CalCtx.Progress(calibration.SampleCount(), CalCtx.SampleCount());
+	CalCtx.Progress(calibration.SampleCount(), requiredSamples);
 
-	if (calibration.SampleCount() < CalCtx.SampleCount())
+	if (calibration.SampleCount() < requiredSamples)
 	{
 		return;
 	}
@@ -678,7 +1055,7 @@ void CalibrationTick(double time)
 		calibration.ShiftSample();
 	}
 
-	if (samples.size() >= CalCtx.SampleCount())
+	if (samples.size() >= requiredSamples)
 	{
 		CalCtx.Log("\n");
 
@@ -706,7 +1083,22 @@ void CalibrationTick(double time)
 			ctx.refToTargetPose = calibration.RelativeTransformation();  // CRITICAL for continuous calibration!
 			ctx.relativePosCalibrated = calibration.isRelativeTransformationCalibrated();  // CRITICAL!
 
+			Metrics::RecordTimestamp();
+			Metrics::appliedRotation.Push(ctx.calibratedRotation);
+			Metrics::appliedTranslation.Push(ctx.calibratedTranslation);
+			Metrics::appliedScale.Push(ctx.calibratedScale);
+
+			// Keyed by the devices it was made with, so it is found again when they reconnect
+			if (auto reference = Devices.Device(ctx.referenceID))
+				ctx.referenceSerial = reference->serial;
+			if (auto target = Devices.Device(ctx.targetID))
+				ctx.targetSerial = target->serial;
+
 			ctx.validProfile = true;
+			auto stored = StoredProfile::FromContext(ctx);
+			if (ctx.state == CalibrationState::Continuous)
+				stored.solverState = calibration.SaveState();
+			Profiles.Put(stored);
 			SaveProfile(ctx);  // Save profile after every update
 
 			// Apply calibration to all devices with lerp/quash flags
@@ -717,8 +1109,8 @@ void CalibrationTick(double time)
 			if (ctx.state == CalibrationState::Continuous)
 			{
 				CalCtx.Log("Continuous calibration updated\n");
-				// Drop some samples to make room for new ones
-				size_t dropSamples = CalCtx.SampleCount() / 10;
+				// Drop some samples to make room for new ones, once the window has filled
+				size_t dropSamples = warmStartKeyframes > 0 ? 0 : CalCtx.SampleCount() / 10;
 				for (size_t i = 0; i < dropSamples && !samples.empty(); i++)
 				{
 					samples.erase(samples.begin());
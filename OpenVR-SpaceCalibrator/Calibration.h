@@ -6,6 +6,7 @@
 #include <iostream>
 #include <vector>
 #include <deque>
+#include <functional>
 #include "../Protocol.h"
 
 enum class CalibrationState
@@ -40,11 +41,14 @@ struct CalibrationContext
 
 	std::string referenceTrackingSystem;
 	std::string targetTrackingSystem;
+	std::string referenceSerial, targetSerial; // devices the active calibration was made with
 
 	bool enabled = false;
 	bool validProfile = false;
 	bool clearOnLog = false;
 	bool quashTargetInContinuous = false;
+	int quashTargetForwardInterval = 0; // forward every Nth target pose while quashed, 0 = none
+	bool recordMetrics = false; // stream solver metrics to a log while continuous calibration runs
 	double timeLastTick = 0, timeLastScan = 0, timeLastAssign = 0;
 	bool ignoreOutliers = false;
 	double wantedUpdateInterval = 1.0;
@@ -139,6 +143,8 @@ struct CalibrationContext
 		calibratedScale = 1.0;
 		referenceTrackingSystem = "";
 		targetTrackingSystem = "";
+		referenceSerial = "";
+		targetSerial = "";
 		enabled = false;
 		validProfile = false;
 		refToTargetPose = Eigen::AffineCompact3d::Identity();
@@ -174,6 +180,7 @@ struct CalibrationContext
 	};
 
 	std::deque<Message> messages;
+	uint64_t messageRevision = 0; // bumped by Log and Progress, so the UI can tell when to redraw
 
 	void Log(const std::string &msg)
 	{
@@ -187,6 +194,7 @@ struct CalibrationContext
 
 		// Linux doesn't have OutputDebugStringA, just print to cerr
 		messages.back().str += msg;
+		messageRevision++;
 		std::cerr << msg;
 
 		while (messages.size() > 15) messages.pop_front();
@@ -199,6 +207,7 @@ struct CalibrationContext
 
 		messages.back().progress = current;
 		messages.back().target = target;
+		messageRevision++;
 	}
 
 	bool TargetPoseIsValidSimple() const {
@@ -214,10 +223,21 @@ struct CalibrationContext
 
 extern CalibrationContext CalCtx;
 
-void InitCalibrator();
+// Seconds on a monotonic clock, the time base CalibrationTick expects
+double CalibrationClock();
+
+// onSample is called from the sampler thread whenever a pose pair is ready for the next tick
+void InitCalibrator(std::function<void()> onSample);
+// CalibrationTick skips calls made sooner than this many seconds after the last one it ran
+const double CalibrationTickInterval = 0.05;
 void CalibrationTick(double time);
 void StartCalibration();
 void StartContinuousCalibration();
 void EndContinuousCalibration();
 void LoadChaperoneBounds();
-void ApplyChaperoneBounds();
\ No newline at end of file
+void ApplyChaperoneBounds();
+void RequestDriverStats(std::function<void(const protocol::DriverStats &)> callback);
+
+// Makes the next scan pick the stored calibration for the connected devices again, as if the
+// device set had changed; for when the stored profiles were replaced
+void RecheckStoredProfile();
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "CalibrationCalc.h"
 #include "Calibration.h"
-// #include "CalibrationMetrics.h" // Windows-only debug feature
+#include "CalibrationMetrics.h"
+
+#include <algorithm>
 // #include "Protocol.h" // Not needed for CalibrationCalc
 
 inline vr::HmdQuaternion_t operator*(const vr::HmdQuaternion_t& lhs, const vr::HmdQuaternion_t& rhs) {
@@ -108,6 +110,8 @@ namespace {
 }
 
 const double CalibrationCalc::AxisVarianceThreshold = 0.001;
+const double CalibrationCalc::RestoredErrorTolerance = 2.0;
+const double CalibrationCalc::RestoredErrorFloor = 0.005; // meters
 void CalibrationCalc::PushSample(const Sample& sample) {
 	m_samples.push_back(sample);
 }
@@ -117,10 +121,77 @@ void CalibrationCalc::Clear() {
 	m_isValid = false;
 	m_samples.clear();
 	m_axisVariance = 0.0;
+	m_priorError = INFINITY;
+	m_restoredKeyframes = 0;
 	m_refToTargetPose = Eigen::AffineCompact3d::Identity();
 	m_relativePosCalibrated = false;
 }
 
+SolverState CalibrationCalc::SaveState() const {
+	SolverState state;
+	state.valid = m_isValid;
+	state.estimatedTransformation = m_estimatedTransformation;
+	state.priorError = m_priorError;
+	state.axisVariance = m_axisVariance;
+
+	if (m_samples.empty())
+		return state;
+
+	// Rotation is only observable from samples that differ in orientation, so keep the ones
+	// spread furthest apart: start from the newest, then repeatedly add the sample whose
+	// reference rotation is furthest from every sample kept so far.
+	std::vector<double> distance(m_samples.size(), INFINITY);
+	size_t next = m_samples.size() - 1;
+	while (state.keyframes.size() < SolverState::MaxKeyframes && distance[next] > 0) {
+		state.keyframes.push_back(m_samples[next]);
+		distance[next] = 0;
+
+		Eigen::Quaterniond chosen(m_samples[next].ref.rot);
+		for (size_t i = 0; i < m_samples.size(); i++) {
+			double angle = chosen.angularDistance(Eigen::Quaterniond(m_samples[i].ref.rot));
+			distance[i] = std::min(distance[i], angle);
+		}
+		next = std::max_element(distance.begin(), distance.end()) - distance.begin();
+	}
+
+	// Oldest first, like the sample window
+	std::sort(state.keyframes.begin(), state.keyframes.end(), [](const Sample &a, const Sample &b) {
+		return a.timestamp < b.timestamp;
+	});
+	return state;
+}
+
+void CalibrationCalc::RestoreState(const SolverState &state) {
+	m_isValid = state.valid;
+	m_estimatedTransformation = state.estimatedTransformation;
+	m_priorError = state.priorError;
+	m_axisVariance = state.axisVariance;
+	m_samples.assign(state.keyframes.begin(), state.keyframes.end());
+	m_restoredKeyframes = m_samples.size();
+}
+
+bool CalibrationCalc::ConfirmRestoredState() {
+	std::deque<Sample> keyframes(m_samples.begin(), m_samples.begin() + m_restoredKeyframes);
+	m_samples.erase(m_samples.begin(), m_samples.begin() + m_restoredKeyframes);
+	m_restoredKeyframes = 0;
+
+	// The fresh samples have to fit about as well as the ones the estimate was accepted on
+	double error = INFINITY;
+	bool confirmed = m_isValid && !m_samples.empty() && ValidateCalibration(m_estimatedTransformation, &error)
+		&& error <= std::max(RestoredErrorTolerance * m_priorError, RestoredErrorFloor);
+
+	if (!confirmed) {
+		m_estimatedTransformation.setIdentity();
+		m_isValid = false;
+		m_axisVariance = 0.0;
+		m_priorError = INFINITY;
+		return false;
+	}
+
+	m_samples.insert(m_samples.begin(), keyframes.begin(), keyframes.end());
+	return true;
+}
+
 std::vector<bool> CalibrationCalc::DetectOutliers() const {
 	// Use bigger step to get a rough rotation.
 	std::vector<DSample> deltas;
@@ -644,6 +715,7 @@ bool CalibrationCalc::ComputeOneshot(const bool ignoreOutliers) {
 	if (valid) {
 		m_estimatedTransformation = calibration; // @NOTE: Normal calibration
 		m_isValid = true;
+		m_priorError = INFINITY;
 		return true;
 	}
 	else {
@@ -662,11 +734,12 @@ void CalibrationCalc::ComputeInstantOffset() {
 	const auto hmdOriginPos = updatedPose.trans - latestSample.ref.trans;
 	const auto hmdSpace = latestSample.ref.rot.inverse() * hmdOriginPos;
 	
-	// Metrics::posOffset_lastSample.Push(hmdSpace * 1000);
+	Metrics::posOffset_lastSample.Push(hmdSpace * 1000);
 }
 
 bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold, double relPoseMaxError, const bool ignoreOutliers) {
-	// Metrics::RecordTimestamp();
+	Metrics::RecordTimestamp();
+	Metrics::ScopedComputeTimer computeTimer;
 
 	if (lockRelativePosition) {
 		Eigen::AffineCompact3d byRelPose;
@@ -675,11 +748,12 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold, double re
 		if (CalibrateByRelPose(byRelPose) &&
 			ValidateCalibration(byRelPose, &relPoseError, &relPosOffset)) {
 
-			// Metrics::posOffset_byRelPose.Push(relPosOffset * 1000);
-			// Metrics::error_byRelPose.Push(relPoseError * 1000);
+			Metrics::posOffset_byRelPose.Push(relPosOffset * 1000);
+			Metrics::error_byRelPose.Push(relPoseError * 1000);
 
 			m_isValid = true;
 			m_estimatedTransformation = byRelPose;
+			m_priorError = relPoseError;
 			return true;
 		}
 	}
@@ -687,8 +761,8 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold, double re
 	double priorCalibrationError = INFINITY;
 	Eigen::Vector3d priorPosOffset;
 	if (m_isValid && ValidateCalibration(m_estimatedTransformation, &priorCalibrationError, &priorPosOffset)) {
-		// Metrics::posOffset_currentCal.Push(priorPosOffset * 1000);
-		// Metrics::error_currentCal.Push(priorCalibrationError * 1000);
+		Metrics::posOffset_currentCal.Push(priorPosOffset * 1000);
+		Metrics::error_currentCal.Push(priorCalibrationError * 1000);
 	}
 
 	double newError = INFINITY;
@@ -701,8 +775,8 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold, double re
 	if (enableStaticRecalibration && CalibrateByRelPose(byRelPose)) {
 		Eigen::Vector3d relPosOffset;
 		if (ValidateCalibration(byRelPose, &relPoseError, &relPosOffset)) {
-			// Metrics::posOffset_byRelPose.Push(relPosOffset * 1000);
-			// Metrics::error_byRelPose.Push(relPoseError * 1000);
+			Metrics::posOffset_byRelPose.Push(relPosOffset * 1000);
+			Metrics::error_byRelPose.Push(relPoseError * 1000);
 
 			if (relPoseError < 0.010 || m_relativePosCalibrated && relPoseError < 0.025) {
 				if (relPoseError * threshold >= priorCalibrationError) {
@@ -727,14 +801,14 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold, double re
 		calibration = ComputeCalibration(ignoreOutliers);
 
 		newVariance = ComputeAxisVariance(calibration)(1);
-		// Metrics::axisIndependence.Push(newVariance);
+		Metrics::axisIndependence.Push(newVariance);
 
 		if (newVariance < AxisVarianceThreshold && newVariance < m_axisVariance) {
 			newCalibrationValid = false;
 			shouldRapidCorrect = false;
 		} else {
 			newCalibrationValid = ValidateCalibration(calibration, &newError, &m_posOffset);
-			// Metrics::posOffset_rawComputed.Push(m_posOffset * 1000);
+			Metrics::posOffset_rawComputed.Push(m_posOffset * 1000);
 		}
 
 		if (m_isValid) {
@@ -745,7 +819,7 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold, double re
 			}
 		}
 
-		// Metrics::error_rawComputed.Push(newError * 1000);
+		Metrics::error_rawComputed.Push(newError * 1000);
 		
 		ComputeInstantOffset();
 	}
@@ -765,7 +839,7 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold, double re
 	if (!newCalibrationValid && shouldRapidCorrect) {
 		
 		double existingPoseErrorUsingRelPosition = RetargetingErrorRMS(m_refToTargetPose.translation(), m_estimatedTransformation);
-		// Metrics::error_currentCalRelPose.Push(existingPoseErrorUsingRelPosition * 1000);
+		Metrics::error_currentCalRelPose.Push(existingPoseErrorUsingRelPosition * 1000);
 		if (relPoseError * threshold < existingPoseErrorUsingRelPosition || newCalibrationValid && relPoseError < newError) {
 			newCalibrationValid = true;
 			usingRelPose = true;
@@ -789,12 +863,13 @@ bool CalibrationCalc::ComputeIncremental(bool &lerp, double threshold, double re
 		m_isValid = true;
 		m_estimatedTransformation = calibration; // @NOTE: Continuous calibration
 		m_axisVariance = newVariance;
+		m_priorError = newError;
 
 		if (!usingRelPose) {
 			m_refToTargetPose = EstimateRefToTargetPose(m_estimatedTransformation);
 		}
 
-		// Metrics::calibrationApplied.Push(!usingRelPose);
+		Metrics::calibrationApplied.Push(!usingRelPose);
 
 		return true;
 	}
@@ -2,6 +2,7 @@
 
 #include <Eigen/Dense>
 #include <openvr.h>
+#include <cmath>
 #include <vector>
 #include <deque>
 #include <iostream>
@@ -55,10 +56,27 @@ struct Sample
 	Sample(Pose ref, Pose target, double timestamp) : valid(true), ref(ref), target(target), timestamp(timestamp){ }
 };
 
+// What continuous calibration needs to resume after a restart without waiting for a full sample
+// window: the estimate, how good it was, and a few samples spread over the rotations seen.
+struct SolverState
+{
+	static const size_t MaxKeyframes = 16;
+
+	bool valid = false;
+	Eigen::AffineCompact3d estimatedTransformation = Eigen::AffineCompact3d::Identity();
+	double priorError = INFINITY; // RMS error of the estimate when it was accepted, in meters
+	double axisVariance = 0.0;
+	std::vector<Sample> keyframes;
+};
+
 class CalibrationCalc {
 public:
 	static const double AxisVarianceThreshold;
 
+	// A restored estimate is kept if its error on fresh samples is within this factor of the error
+	// it was saved with, or under the floor
+	static const double RestoredErrorTolerance, RestoredErrorFloor;
+
 	bool enableStaticRecalibration;
 	bool lockRelativePosition = false;
 	
@@ -95,6 +113,16 @@ public:
 	void PushSample(const Sample& sample);
 	void Clear();
 
+	SolverState SaveState() const;
+	// Replaces everything but the relative transformation, which the caller restores separately
+	void RestoreState(const SolverState &state);
+
+	// Checks the restored estimate against the samples pushed since RestoreState alone, so the
+	// saved keyframes can't vouch for themselves. If it doesn't hold, e.g. because a tracking
+	// space moved in between, the estimate and keyframes are dropped as if starting cold.
+	bool ConfirmRestoredState();
+	size_t RestoredKeyframes() const { return m_restoredKeyframes; }
+
 	double ReferenceJitter() const;
 	double TargetJitter() const;
 
@@ -114,6 +142,10 @@ public:
 	// Debug fields
 	Eigen::Vector3d m_posOffset;
 	double m_axisVariance = 0.0;
+	double m_priorError = INFINITY;
+
+	// Leading samples that came from RestoreState and are yet to be confirmed
+	size_t m_restoredKeyframes = 0;
 	long m_calcCycle;
 
 private:
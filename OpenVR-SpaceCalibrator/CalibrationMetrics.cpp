@@ -0,0 +1,259 @@
+#include "CalibrationMetrics.h"
+#include "Calibration.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace Metrics {
+	uint16_t RegisterSeries(const char *name)
+	{
+		auto &names = const_cast<std::vector<const char *> &>(SeriesNames());
+		names.push_back(name);
+		return (uint16_t) (names.size() - 1);
+	}
+
+	const std::vector<const char *> &SeriesNames()
+	{
+		// Function local so series in any translation unit can register during static init
+		static std::vector<const char *> names;
+		return names;
+	}
+
+	double timestamp = 0;
+	std::atomic<bool> logging = { false };
+
+	TimeSeries<Eigen::Vector3d> posOffset_rawComputed("posOffset_rawComputed");
+	TimeSeries<Eigen::Vector3d> posOffset_currentCal("posOffset_currentCal");
+	TimeSeries<Eigen::Vector3d> posOffset_lastSample("posOffset_lastSample");
+	TimeSeries<Eigen::Vector3d> posOffset_byRelPose("posOffset_byRelPose");
+
+	TimeSeries<double> error_rawComputed("error_rawComputed");
+	TimeSeries<double> error_currentCal("error_currentCal");
+	TimeSeries<double> error_currentCalRelPose("error_currentCalRelPose");
+	TimeSeries<double> error_byRelPose("error_byRelPose");
+
+	TimeSeries<double> axisIndependence("axisIndependence");
+	TimeSeries<double> computationTime("computationTime");
+	TimeSeries<bool> calibrationApplied("calibrationApplied");
+
+	TimeSeries<Eigen::Vector3d> appliedRotation("appliedRotation");
+	TimeSeries<Eigen::Vector3d> appliedTranslation("appliedTranslation");
+	TimeSeries<double> appliedScale("appliedScale");
+
+	void RecordTimestamp()
+	{
+		timestamp = CalibrationClock();
+	}
+
+	ScopedComputeTimer::ScopedComputeTimer() : start(CalibrationClock())
+	{
+	}
+
+	ScopedComputeTimer::~ScopedComputeTimer()
+	{
+		computationTime.Push((CalibrationClock() - start) * 1000.0);
+	}
+}
+
+namespace {
+	const size_t FlushThreshold = 64 * 1024;
+	const size_t MaxFileSize = 64 * 1024 * 1024;
+	const size_t MaxLogFiles = 16;
+	const auto FlushInterval = std::chrono::seconds(1);
+
+	std::mutex logMutex;
+	std::condition_variable logWake;
+	std::thread logThread;
+	bool logRunning = false;
+
+	// Records appended by the calibration tick since the writer last took them
+	std::vector<char> pending;
+
+	void AppendRecord(std::vector<char> &out, uint16_t kind, uint16_t series, double time, const void *payload, uint32_t length)
+	{
+		Metrics::LogFormat::RecordHeader header = { kind, series, length, time };
+		const char *bytes = reinterpret_cast<const char *>(&header);
+		out.insert(out.end(), bytes, bytes + sizeof(header));
+		out.insert(out.end(), (const char *) payload, (const char *) payload + length);
+	}
+
+	void QueueRecord(uint16_t kind, uint16_t series, double time, const void *payload, uint32_t length)
+	{
+		std::lock_guard<std::mutex> lock(logMutex);
+		if (!logRunning)
+			return;
+
+		AppendRecord(pending, kind, series, time, payload, length);
+		if (pending.size() >= FlushThreshold)
+			logWake.notify_one();
+	}
+
+	std::filesystem::path LogDirectory()
+	{
+		const char *home = getenv("HOME");
+		return std::filesystem::path(home ? home : ".") / ".config" / "OpenVR-SpaceCalibrator" / "metrics";
+	}
+
+	void RemoveOldLogs(const std::filesystem::path &directory)
+	{
+		std::error_code err;
+		std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> logs;
+		for (auto &entry : std::filesystem::directory_iterator(directory, err))
+		{
+			if (entry.path().extension() == ".scm")
+				logs.emplace_back(entry.last_write_time(err), entry.path());
+		}
+
+		std::sort(logs.begin(), logs.end());
+		for (size_t i = 0; i + MaxLogFiles < logs.size(); ++i)
+			std::filesystem::remove(logs[i].second, err);
+	}
+
+	FILE *OpenLogFile()
+	{
+		auto directory = LogDirectory();
+		std::error_code err;
+		std::filesystem::create_directories(directory, err);
+
+		char name[64];
+		time_t now = time(nullptr);
+		tm local;
+		localtime_r(&now, &local);
+		strftime(name, sizeof name, "metrics-%Y%m%d-%H%M%S", &local);
+
+		auto path = directory / (std::string(name) + ".scm");
+		for (int i = 1; std::filesystem::exists(path, err); ++i)
+			path = directory / (std::string(name) + "-" + std::to_string(i) + ".scm");
+
+		FILE *file = fopen(path.c_str(), "wb");
+		if (!file)
+		{
+			std::cerr << "Could not create metrics log " << path << std::endl;
+			return nullptr;
+		}
+
+		// Each file describes its own series, so it can be read without the ones before it
+		std::vector<char> header(sizeof(Metrics::LogFormat::FileHeader));
+		Metrics::LogFormat::FileHeader fileHeader = {};
+		memcpy(fileHeader.magic, Metrics::LogFormat::Magic, sizeof(fileHeader.magic));
+		fileHeader.version = Metrics::LogFormat::Version;
+		memcpy(header.data(), &fileHeader, sizeof(fileHeader));
+
+		auto &names = Metrics::SeriesNames();
+		for (size_t id = 0; id < names.size(); ++id)
+			AppendRecord(header, Metrics::LogFormat::SeriesName, (uint16_t) id, 0.0, names[id], (uint32_t) strlen(names[id]));
+
+		fwrite(header.data(), 1, header.size(), file);
+		std::cout << "Recording metrics to " << path << std::endl;
+
+		RemoveOldLogs(directory);
+		return file;
+	}
+
+	void RunLogWriter()
+	{
+		FILE *file = nullptr;
+		size_t fileSize = 0;
+		std::vector<char> batch;
+
+		std::unique_lock<std::mutex> lock(logMutex);
+		for (;;)
+		{
+			logWake.wait_for(lock, FlushInterval, [] { return !logRunning || pending.size() >= FlushThreshold; });
+			bool stopping = !logRunning;
+			batch.swap(pending);
+			lock.unlock();
+
+			if (!batch.empty())
+			{
+				if (file && fileSize >= MaxFileSize)
+				{
+					fclose(file);
+					file = nullptr;
+				}
+				if (!file)
+				{
+					file = OpenLogFile();
+					fileSize = 0;
+				}
+				if (file)
+				{
+					fwrite(batch.data(), 1, batch.size(), file);
+					fflush(file);
+					fileSize += batch.size();
+				}
+				batch.clear();
+			}
+
+			lock.lock();
+			if (stopping)
+				break;
+		}
+
+		if (file)
+			fclose(file);
+	}
+}
+
+void Metrics::LogSample(uint16_t series, double time, double value)
+{
+	QueueRecord(LogFormat::Scalar, series, time, &value, sizeof(value));
+}
+
+void Metrics::LogSample(uint16_t series, double time, const Eigen::Vector3d &value)
+{
+	double xyz[3] = { value.x(), value.y(), value.z() };
+	QueueRecord(LogFormat::Vector3, series, time, xyz, sizeof(xyz));
+}
+
+void Metrics::LogSample(uint16_t series, double time, bool value)
+{
+	uint8_t flag = value ? 1 : 0;
+	QueueRecord(LogFormat::Flag, series, time, &flag, sizeof(flag));
+}
+
+void Metrics::StartLog()
+{
+	std::lock_guard<std::mutex> lock(logMutex);
+	if (logRunning)
+		return;
+
+	logRunning = true;
+	logThread = std::thread(RunLogWriter);
+	logging.store(true, std::memory_order_relaxed);
+}
+
+void Metrics::StopLog()
+{
+	{
+		std::lock_guard<std::mutex> lock(logMutex);
+		if (!logRunning)
+			return;
+
+		logging.store(false, std::memory_order_relaxed);
+		logRunning = false;
+	}
+
+	logWake.notify_one();
+	logThread.join();
+}
+
+bool Metrics::IsLogging()
+{
+	return logging.load(std::memory_order_relaxed);
+}
+
+void Metrics::WriteLogAnnotation(const char *text)
+{
+	if (IsLogging())
+		QueueRecord(LogFormat::Annotation, 0, CalibrationClock(), text, (uint32_t) strlen(text));
+}
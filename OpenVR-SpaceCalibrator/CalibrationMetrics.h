@@ -0,0 +1,152 @@
+#pragma once
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Solver internals recorded on every continuous calibration tick, for live plots while tuning
+// thresholds. Each series is a fixed-size ring with a single writer (the calibration tick):
+// Push stores the sample and publishes it with one release store, so recording costs the same
+// whether or not anything reads it. Readers copy what they need and discard any entries the
+// writer lapped while they were copying.
+namespace Metrics {
+	// Series IDs in the log, in declaration order
+	uint16_t RegisterSeries(const char *name);
+	const std::vector<const char *> &SeriesNames();
+
+	extern std::atomic<bool> logging;
+	void LogSample(uint16_t series, double time, double value);
+	void LogSample(uint16_t series, double time, const Eigen::Vector3d &value);
+	void LogSample(uint16_t series, double time, bool value);
+
+	template<typename T>
+	class TimeSeries
+	{
+	public:
+		static const size_t Capacity = 1024;
+
+		struct Entry
+		{
+			double time;
+			T value;
+		};
+
+		explicit TimeSeries(const char *name) : name(name), id(RegisterSeries(name)) { }
+
+		const char *const name;
+		const uint16_t id;
+
+		void Push(const T &value);
+
+		// Appends the entries recorded at or after since, oldest first
+		void Read(double since, std::vector<Entry> &out) const;
+
+		bool Empty() const { return count.load(std::memory_order_acquire) == 0; }
+
+	private:
+		Entry entries[Capacity];
+		std::atomic<uint64_t> count = { 0 };
+	};
+
+	// Time of the tick being recorded, in CalibrationClock seconds
+	extern double timestamp;
+	void RecordTimestamp();
+
+	extern TimeSeries<Eigen::Vector3d> posOffset_rawComputed, posOffset_currentCal, posOffset_lastSample, posOffset_byRelPose;
+	extern TimeSeries<double> error_rawComputed, error_currentCal, error_currentCalRelPose, error_byRelPose;
+	extern TimeSeries<double> axisIndependence;
+	extern TimeSeries<double> computationTime;
+	// One entry per applied transform: true when it came from a full solve, false for the relative pose
+	extern TimeSeries<bool> calibrationApplied;
+
+	// Transforms applied to the target system: euler angles in degrees, translation in cm
+	extern TimeSeries<Eigen::Vector3d> appliedRotation, appliedTranslation;
+	extern TimeSeries<double> appliedScale;
+
+	// Pushes the enclosing scope's duration, in milliseconds, to computationTime
+	class ScopedComputeTimer
+	{
+	public:
+		ScopedComputeTimer();
+		~ScopedComputeTimer();
+
+	private:
+		double start;
+	};
+
+	// Streams every pushed sample and annotation to a binary log under
+	// ~/.config/OpenVR-SpaceCalibrator/metrics/. The tick only appends to a buffer; a background
+	// thread writes it out once a second or every 64 KiB and starts a new file every 64 MiB,
+	// keeping the newest 16. spacecal-metrics-csv converts a log to CSV.
+	void StartLog();
+	void StopLog();
+	bool IsLogging();
+	void WriteLogAnnotation(const char *text);
+
+	namespace LogFormat {
+		const char Magic[8] = { 'S', 'C', 'M', 'E', 'T', 'R', 'I', 'C' };
+		const uint32_t Version = 1;
+
+		struct FileHeader
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t reserved;
+		};
+
+		enum RecordKind : uint16_t
+		{
+			SeriesName = 1, // payload: name; written for every series at the start of each file
+			Scalar,         // payload: double
+			Vector3,        // payload: double[3]
+			Flag,           // payload: uint8_t
+			Annotation,     // payload: text
+		};
+
+		// Followed by length bytes of payload. Native endianness, like the rest of the project.
+		struct RecordHeader
+		{
+			uint16_t kind;
+			uint16_t series;
+			uint32_t length;
+			double time;
+		};
+
+		static_assert(sizeof(FileHeader) == 16 && sizeof(RecordHeader) == 16, "log layout");
+	}
+}
+
+template<typename T>
+void Metrics::TimeSeries<T>::Push(const T &value)
+{
+	uint64_t index = count.load(std::memory_order_relaxed);
+	entries[index % Capacity] = { timestamp, value };
+	count.store(index + 1, std::memory_order_release);
+
+	if (logging.load(std::memory_order_relaxed))
+		LogSample(id, timestamp, value);
+}
+
+template<typename T>
+void Metrics::TimeSeries<T>::Read(double since, std::vector<Entry> &out) const
+{
+	uint64_t end = count.load(std::memory_order_acquire);
+	uint64_t begin = end > Capacity ? end - Capacity : 0;
+
+	size_t first = out.size();
+	for (uint64_t i = begin; i < end; ++i)
+		out.push_back(entries[i % Capacity]);
+
+	// Entries the writer overwrote while they were being copied are the oldest ones. The slot of
+	// the next unpublished entry may be half written too, hence the + 1.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t written = count.load(std::memory_order_relaxed) + 1;
+	size_t overwritten = written - begin > Capacity ? (size_t) std::min<uint64_t>(written - begin - Capacity, end - begin) : 0;
+
+	// Entries are in time order, so everything before since is a prefix
+	auto keep = std::find_if(out.begin() + first + overwritten, out.end(), [since](const Entry &entry) { return entry.time >= since; });
+	out.erase(out.begin() + first, keep);
+}
@@ -1,198 +1,467 @@
 #include "Configuration.h"
 
-#include "picojson.h"
+#include "JsonStream.h"
+#include "ProfileStore.h"
 
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
 #include <limits>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+
+// One bit for each of the tracking systems, rotation and translation members of a profile
+static const uint32_t AllProfileFields = (1 << 8) - 1;
+
+static Eigen::AffineCompact3d ParseRelativeTransform(JsonReader &json)
+{
+	Eigen::Vector3d refToTargetTranslation, refToTargetRotation;
+	uint32_t found = 0;
 
+	std::string_view key;
+	json.BeginObject();
+	while (json.NextKey(key))
+	{
+		if (key == "x") { refToTargetTranslation[0] = json.Double(); found |= 1 << 0; }
+		else if (key == "y") { refToTargetTranslation[1] = json.Double(); found |= 1 << 1; }
+		else if (key == "z") { refToTargetTranslation[2] = json.Double(); found |= 1 << 2; }
+		else if (key == "roll") { refToTargetRotation[0] = json.Double(); found |= 1 << 3; }
+		else if (key == "yaw") { refToTargetRotation[1] = json.Double(); found |= 1 << 4; }
+		else if (key == "pitch") { refToTargetRotation[2] = json.Double(); found |= 1 << 5; }
+		else json.Skip();
+	}
 
-static picojson::array FloatArray(const float *buf, int numFloats)
-{
-	picojson::array arr;
+	if (found != (1 << 6) - 1)
+		throw std::runtime_error("incomplete relative transform");
 
-	for (int i = 0; i < numFloats; i++)
-		arr.push_back(picojson::value(double(buf[i])));
+	Eigen::Matrix3d rotationMatrix = (
+		Eigen::AngleAxisd(refToTargetRotation[0], Eigen::Vector3d::UnitX()) *
+		Eigen::AngleAxisd(refToTargetRotation[1], Eigen::Vector3d::UnitY()) *
+		Eigen::AngleAxisd(refToTargetRotation[2], Eigen::Vector3d::UnitZ())
+	).toRotationMatrix();
 
-	return arr;
+	Eigen::AffineCompact3d refToTargetPose = Eigen::AffineCompact3d::Identity();
+	refToTargetPose.linear() = rotationMatrix;
+	refToTargetPose.translation() = refToTargetTranslation;
+	return refToTargetPose;
 }
 
-static void LoadFloatArray(const picojson::value &obj, float *buf, int numFloats)
-{
-	if (!obj.is<picojson::array>())
-		throw std::runtime_error("expected array, got " + obj.to_str());
+// Keyframes are stored flat: reference rotation (w, x, y, z) and position, then the same for the target
+static const size_t FloatsPerKeyframe = 14;
 
-	auto &arr = obj.get<picojson::array>();
-	if (arr.size() != numFloats)
-		throw std::runtime_error("wrong buffer size");
+static void WritePose(float *out, const Pose &pose)
+{
+	Eigen::Quaterniond rot(pose.rot);
+	float values[] = {
+		(float) rot.w(), (float) rot.x(), (float) rot.y(), (float) rot.z(),
+		(float) pose.trans.x(), (float) pose.trans.y(), (float) pose.trans.z(),
+	};
+	memcpy(out, values, sizeof(values));
+}
 
-	for (int i = 0; i < numFloats; i++)
-		buf[i] = (float) arr[i].get<double>();
+static Pose ReadPose(const float *in)
+{
+	vr::HmdQuaternion_t rot = { in[0], in[1], in[2], in[3] };
+	double trans[3] = { in[4], in[5], in[6] };
+	return Pose(rot, trans);
 }
 
-static void ParseProfile(CalibrationContext &ctx, std::istream &stream)
+static SolverState ParseSolverState(JsonReader &json)
 {
-	picojson::value v;
-	std::string err = picojson::parse(v, stream);
-	if (!err.empty())
-		throw std::runtime_error(err);
+	SolverState state;
+	bool hasEstimate = false;
 
-	auto arr = v.get<picojson::array>();
-	if (arr.size() < 1)
-		throw std::runtime_error("no profiles in file");
+	std::string_view key;
+	json.BeginObject();
+	while (json.NextKey(key))
+	{
+		if (key == "valid") state.valid = json.Bool();
+		else if (key == "prior_error") state.priorError = json.Double();
+		else if (key == "axis_variance") state.axisVariance = json.Double();
+		else if (key == "estimate")
+		{
+			json.DoubleArray(state.estimatedTransformation.data(), 12);
+			hasEstimate = true;
+		}
+		else if (key == "keyframes")
+		{
+			float values[FloatsPerKeyframe];
+			size_t filled = 0;
+
+			json.BeginArray();
+			while (json.NextElement())
+			{
+				values[filled++] = json.Float();
+				if (filled < FloatsPerKeyframe)
+					continue;
+
+				filled = 0;
+				if (state.keyframes.size() < SolverState::MaxKeyframes)
+					state.keyframes.emplace_back(ReadPose(values), ReadPose(values + 7), 0.0);
+			}
+
+			if (filled != 0)
+				throw std::runtime_error("solver keyframes are not a whole number of samples");
+		}
+		else json.Skip();
+	}
+
+	// An estimate without its samples can't be checked against anything
+	if (!hasEstimate || state.keyframes.empty())
+		return SolverState();
+	return state;
+}
 
-	auto obj = arr[0].get<picojson::object>();
+static void WriteSolverState(JsonWriter &json, const SolverState &state)
+{
+	std::vector<float> keyframes(state.keyframes.size() * FloatsPerKeyframe);
+	for (size_t i = 0; i < state.keyframes.size(); i++)
+	{
+		WritePose(&keyframes[i * FloatsPerKeyframe], state.keyframes[i].ref);
+		WritePose(&keyframes[i * FloatsPerKeyframe + 7], state.keyframes[i].target);
+	}
 
-	ctx.referenceTrackingSystem = obj["reference_tracking_system"].get<std::string>();
-	ctx.targetTrackingSystem = obj["target_tracking_system"].get<std::string>();
-	ctx.calibratedRotation(0) = obj["roll"].get<double>();
-	ctx.calibratedRotation(1) = obj["yaw"].get<double>();
-	ctx.calibratedRotation(2) = obj["pitch"].get<double>();
-	ctx.calibratedTranslation(0) = obj["x"].get<double>();
-	ctx.calibratedTranslation(1) = obj["y"].get<double>();
-	ctx.calibratedTranslation(2) = obj["z"].get<double>();
+	json.BeginObject();
+	json.Key("valid"); json.Bool(state.valid);
+	if (std::isfinite(state.priorError))
+	{
+		json.Key("prior_error"); json.Number(state.priorError);
+	}
+	json.Key("axis_variance"); json.Number(state.axisVariance);
+	json.Key("estimate"); json.DoubleArray(state.estimatedTransformation.data(), 12);
+	json.Key("keyframes"); json.FloatArray(keyframes.data(), keyframes.size());
+	json.EndObject();
+}
 
-	if (obj["scale"].is<double>())
-		ctx.calibratedScale = obj["scale"].get<double>();
+// Reads key's value if it is one of the members every stored profile has. Returns false, without
+// consuming anything, for other keys.
+static bool ParseCalibrationMember(StoredProfile &profile, std::string_view key, JsonReader &json, uint32_t &found)
+{
+	auto optional = [&json](JsonReader::Type type) {
+		if (json.Peek() == type)
+			return true;
+		json.Skip();
+		return false;
+	};
+
+	if (key == "reference_tracking_system") { profile.key.referenceTrackingSystem = json.String(); found |= 1 << 0; }
+	else if (key == "target_tracking_system") { profile.key.targetTrackingSystem = json.String(); found |= 1 << 1; }
+	else if (key == "roll") { profile.calibratedRotation(0) = json.Double(); found |= 1 << 2; }
+	else if (key == "yaw") { profile.calibratedRotation(1) = json.Double(); found |= 1 << 3; }
+	else if (key == "pitch") { profile.calibratedRotation(2) = json.Double(); found |= 1 << 4; }
+	else if (key == "x") { profile.calibratedTranslation(0) = json.Double(); found |= 1 << 5; }
+	else if (key == "y") { profile.calibratedTranslation(1) = json.Double(); found |= 1 << 6; }
+	else if (key == "z") { profile.calibratedTranslation(2) = json.Double(); found |= 1 << 7; }
+	else if (key == "reference_serial")
+	{
+		if (optional(JsonReader::Type::String))
+			profile.key.referenceSerial = json.String();
+	}
+	else if (key == "target_serial")
+	{
+		if (optional(JsonReader::Type::String))
+			profile.key.targetSerial = json.String();
+	}
+	else if (key == "scale")
+	{
+		if (optional(JsonReader::Type::Number))
+			profile.calibratedScale = json.Double();
+	}
+	// Continuous calibration fields
+	else if (key == "relative_pos_calibrated")
+	{
+		if (optional(JsonReader::Type::Bool))
+			profile.relativePosCalibrated = json.Bool();
+	}
+	else if (key == "relative_transform")
+	{
+		if (optional(JsonReader::Type::Object))
+			profile.refToTargetPose = ParseRelativeTransform(json);
+	}
+	else if (key == "solver_state")
+	{
+		if (optional(JsonReader::Type::Object))
+			profile.solverState = ParseSolverState(json);
+	}
 	else
-		ctx.calibratedScale = 1.0;
+		return false;
+
+	return true;
+}
 
-	if (obj["calibration_speed"].is<double>())
-		ctx.calibrationSpeed = (CalibrationContext::Speed)(int) obj["calibration_speed"].get<double>();
+static void ParseChaperone(CalibrationContext &ctx, JsonReader &json)
+{
+	const size_t floatsPerQuad = sizeof(vr::HmdQuad_t) / sizeof(float);
+	bool hasAutoApply = false, hasPlaySpace = false, hasStandingCenter = false, hasGeometry = false;
 
-	// Load continuous calibration fields
-	if (obj["relative_pos_calibrated"].is<bool>()) {
-		ctx.relativePosCalibrated = obj["relative_pos_calibrated"].get<bool>();
-	}
-	if (obj["lock_relative_position"].is<bool>()) {
-		ctx.lockRelativePosition = obj["lock_relative_position"].get<bool>();
+	std::string_view key;
+	json.BeginObject();
+	while (json.NextKey(key))
+	{
+		if (key == "auto_apply")
+		{
+			ctx.chaperone.autoApply = json.Bool();
+			hasAutoApply = true;
+		}
+		else if (key == "play_space_size")
+		{
+			json.FloatArray(ctx.chaperone.playSpaceSize.v, 2);
+			hasPlaySpace = true;
+		}
+		else if (key == "standing_center")
+		{
+			json.FloatArray((float *) ctx.chaperone.standingCenter.m, sizeof(ctx.chaperone.standingCenter.m) / sizeof(float));
+			hasStandingCenter = true;
+		}
+		else if (key == "geometry")
+		{
+			if (json.Peek() != JsonReader::Type::Array)
+				throw std::runtime_error("chaperone geometry is not an array");
+
+			// The corners are a flat list of floats, parsed straight into quads
+			ctx.chaperone.geometry.clear();
+			vr::HmdQuad_t quad;
+			float *corners = (float *) &quad;
+			size_t filled = 0;
+
+			json.BeginArray();
+			while (json.NextElement())
+			{
+				corners[filled++] = json.Float();
+				if (filled == floatsPerQuad)
+				{
+					ctx.chaperone.geometry.push_back(quad);
+					filled = 0;
+				}
+			}
+
+			if (filled != 0)
+				throw std::runtime_error("chaperone geometry is not a whole number of quads");
+			hasGeometry = true;
+		}
+		else json.Skip();
 	}
 
-	// Load relative transform (refToTargetPose)
-	if (obj["relative_transform"].is<picojson::object>()) {
-		auto refToTarget = obj["relative_transform"].get<picojson::object>();
-		Eigen::Vector3d refToTargetTranslation(
-			refToTarget["x"].get<double>(),
-			refToTarget["y"].get<double>(),
-			refToTarget["z"].get<double>()
-		);
+	if (!hasAutoApply || !hasPlaySpace || !hasStandingCenter || !hasGeometry)
+		throw std::runtime_error("incomplete chaperone");
 
-		Eigen::Vector3d refToTargetRotation(
-			refToTarget["roll"].get<double>(),
-			refToTarget["yaw"].get<double>(),
-			refToTarget["pitch"].get<double>()
-		);
+	if (!ctx.chaperone.geometry.empty())
+		ctx.chaperone.valid = true;
+}
 
-		Eigen::Matrix3d rotationMatrix = (
-			Eigen::AngleAxisd(refToTargetRotation[0], Eigen::Vector3d::UnitX()) *
-			Eigen::AngleAxisd(refToTargetRotation[1], Eigen::Vector3d::UnitY()) *
-			Eigen::AngleAxisd(refToTargetRotation[2], Eigen::Vector3d::UnitZ())
-		).toRotationMatrix();
+// The first profile in the file carries the settings and, unless it is marked inactive, is the
+// one in use. Every profile, the first included, goes into store.
+static void ParseProfile(CalibrationContext &ctx, ProfileStore &store, const std::string &text)
+{
+	JsonReader json(text);
+	json.BeginArray();
+	if (!json.NextElement())
+		throw std::runtime_error("no profiles in file");
 
-		ctx.refToTargetPose = Eigen::AffineCompact3d::Identity();
-		ctx.refToTargetPose.linear() = rotationMatrix;
-		ctx.refToTargetPose.translation() = refToTargetTranslation;
-	}
+	store.Clear();
+	StoredProfile active;
+	bool isActive = true;
+	uint32_t found = 0;
 
-	if (obj["chaperone"].is<picojson::object>())
+	std::string_view key;
+	json.BeginObject();
+	while (json.NextKey(key))
 	{
-		auto chaperone = obj["chaperone"].get<picojson::object>();
-		ctx.chaperone.autoApply = chaperone["auto_apply"].get<bool>();
+		auto optional = [&json](JsonReader::Type type) {
+			if (json.Peek() == type)
+				return true;
+			json.Skip();
+			return false;
+		};
 
-		LoadFloatArray(chaperone["play_space_size"], ctx.chaperone.playSpaceSize.v, 2);
+		if (ParseCalibrationMember(active, key, json, found))
+			continue;
 
-		LoadFloatArray(
-			chaperone["standing_center"],
-			(float *) ctx.chaperone.standingCenter.m,
-			sizeof(ctx.chaperone.standingCenter.m) / sizeof(float)
-		);
+		if (key == "active")
+		{
+			if (optional(JsonReader::Type::Bool))
+				isActive = json.Bool();
+		}
+		else if (key == "calibration_speed")
+		{
+			if (optional(JsonReader::Type::Number))
+				ctx.calibrationSpeed = (CalibrationContext::Speed)(int) json.Double();
+		}
+		else if (key == "lock_relative_position")
+		{
+			if (optional(JsonReader::Type::Bool))
+				ctx.lockRelativePosition = json.Bool();
+		}
+		else if (key == "quash_target_in_continuous")
+		{
+			if (optional(JsonReader::Type::Bool))
+				ctx.quashTargetInContinuous = json.Bool();
+		}
+		else if (key == "quash_target_forward_interval")
+		{
+			if (optional(JsonReader::Type::Number))
+				ctx.quashTargetForwardInterval = (int) json.Double();
+		}
+		else if (key == "record_metrics_log")
+		{
+			if (optional(JsonReader::Type::Bool))
+				ctx.recordMetrics = json.Bool();
+		}
+		else if (key == "chaperone")
+		{
+			if (optional(JsonReader::Type::Object))
+				ParseChaperone(ctx, json);
+		}
+		else json.Skip();
+	}
 
-		if (!chaperone["geometry"].is<picojson::array>())
-			throw std::runtime_error("chaperone geometry is not an array");
+	if (found != AllProfileFields)
+		throw std::runtime_error("profile is missing its tracking systems or calibration");
+	store.Put(active);
 
-		auto &geometry = chaperone["geometry"].get<picojson::array>();
+	while (json.NextElement())
+	{
+		StoredProfile profile;
+		found = 0;
 
-		if (geometry.size() > 0)
+		json.BeginObject();
+		while (json.NextKey(key))
 		{
-			ctx.chaperone.geometry.resize(geometry.size() * sizeof(float) / sizeof(ctx.chaperone.geometry[0]));
-			LoadFloatArray(chaperone["geometry"], (float *) ctx.chaperone.geometry.data(), geometry.size());
-
-			ctx.chaperone.valid = true;
+			if (!ParseCalibrationMember(profile, key, json, found))
+				json.Skip();
 		}
+
+		if (found == AllProfileFields)
+			store.Put(profile);
+		else
+			std::cerr << "Skipping incomplete stored profile" << std::endl;
 	}
+	json.End();
 
-	ctx.validProfile = true;
+	if (isActive)
+		active.ApplyTo(ctx);
 }
 
-static void WriteProfile(CalibrationContext &ctx, std::ostream &out)
+static void WriteCalibration(JsonWriter &json, const StoredProfile &profile)
 {
-	if (!ctx.validProfile)
+	json.Key("reference_tracking_system"); json.String(profile.key.referenceTrackingSystem);
+	json.Key("target_tracking_system"); json.String(profile.key.targetTrackingSystem);
+	json.Key("reference_serial"); json.String(profile.key.referenceSerial);
+	json.Key("target_serial"); json.String(profile.key.targetSerial);
+	json.Key("roll"); json.Number(profile.calibratedRotation(0));
+	json.Key("yaw"); json.Number(profile.calibratedRotation(1));
+	json.Key("pitch"); json.Number(profile.calibratedRotation(2));
+	json.Key("x"); json.Number(profile.calibratedTranslation(0));
+	json.Key("y"); json.Number(profile.calibratedTranslation(1));
+	json.Key("z"); json.Number(profile.calibratedTranslation(2));
+	json.Key("scale"); json.Number(profile.calibratedScale);
+
+	// Save continuous calibration fields
+	json.Key("relative_pos_calibrated"); json.Bool(profile.relativePosCalibrated);
+
+	Eigen::Vector3d refToTargetRotation = profile.refToTargetPose.rotation().eulerAngles(0, 1, 2);
+	Eigen::Vector3d refToTargetTranslation = profile.refToTargetPose.translation();
+	json.Key("relative_transform");
+	json.BeginObject();
+	json.Key("x"); json.Number(refToTargetTranslation(0));
+	json.Key("y"); json.Number(refToTargetTranslation(1));
+	json.Key("z"); json.Number(refToTargetTranslation(2));
+	json.Key("roll"); json.Number(refToTargetRotation(0));
+	json.Key("yaw"); json.Number(refToTargetRotation(1));
+	json.Key("pitch"); json.Number(refToTargetRotation(2));
+	json.EndObject();
+
+	if (!profile.solverState.keyframes.empty())
+	{
+		json.Key("solver_state");
+		WriteSolverState(json, profile.solverState);
+	}
+}
+
+static void WriteProfile(CalibrationContext &ctx, std::string &out)
+{
+	auto &stored = Profiles.All();
+	if (!ctx.validProfile && stored.empty())
 		return;
 
-	picojson::object profile;
-	profile["reference_tracking_system"].set<std::string>(ctx.referenceTrackingSystem);
-	profile["target_tracking_system"].set<std::string>(ctx.targetTrackingSystem);
-	profile["roll"].set<double>(ctx.calibratedRotation(0));
-	profile["yaw"].set<double>(ctx.calibratedRotation(1));
-	profile["pitch"].set<double>(ctx.calibratedRotation(2));
-	profile["x"].set<double>(ctx.calibratedTranslation(0));
-	profile["y"].set<double>(ctx.calibratedTranslation(1));
-	profile["z"].set<double>(ctx.calibratedTranslation(2));
-	profile["scale"].set<double>(ctx.calibratedScale);
+	// Without an active calibration, the first stored one holds the settings instead
+	StoredProfile first = ctx.validProfile ? StoredProfile::FromContext(ctx) : stored.front();
+	if (auto previous = Profiles.Find(first.key))
+		first.solverState = previous->solverState;
 
-	double speed = (int) ctx.calibrationSpeed;
-	profile["calibration_speed"].set<double>(speed);
+	JsonWriter json(out);
+	json.BeginArray();
+	json.BeginObject();
 
-	// Save continuous calibration fields
-	Eigen::Vector3d refToTargetRotation = ctx.refToTargetPose.rotation().eulerAngles(0, 1, 2);
-	Eigen::Vector3d refToTargetTranslation = ctx.refToTargetPose.translation();
-	picojson::object refToTarget;
-	refToTarget["x"].set<double>(refToTargetTranslation(0));
-	refToTarget["y"].set<double>(refToTargetTranslation(1));
-	refToTarget["z"].set<double>(refToTargetTranslation(2));
-	refToTarget["roll"].set<double>(refToTargetRotation(0));
-	refToTarget["yaw"].set<double>(refToTargetRotation(1));
-	refToTarget["pitch"].set<double>(refToTargetRotation(2));
-	profile["relative_pos_calibrated"].set<bool>(ctx.relativePosCalibrated);
-	profile["lock_relative_position"].set<bool>(ctx.lockRelativePosition);
-	profile["relative_transform"].set<picojson::object>(refToTarget);
+	WriteCalibration(json, first);
+	if (!ctx.validProfile)
+	{
+		json.Key("active"); json.Bool(false);
+	}
+
+	json.Key("calibration_speed"); json.Number((int) ctx.calibrationSpeed);
+	json.Key("lock_relative_position"); json.Bool(ctx.lockRelativePosition);
+	json.Key("quash_target_in_continuous"); json.Bool(ctx.quashTargetInContinuous);
+	json.Key("quash_target_forward_interval"); json.Number(ctx.quashTargetForwardInterval);
+	json.Key("record_metrics_log"); json.Bool(ctx.recordMetrics);
 
 	if (ctx.chaperone.valid)
 	{
-		picojson::object chaperone;
-		chaperone["auto_apply"].set<bool>(ctx.chaperone.autoApply);
-		chaperone["play_space_size"].set<picojson::array>(FloatArray(ctx.chaperone.playSpaceSize.v, 2));
+		json.Key("chaperone");
+		json.BeginObject();
+		json.Key("auto_apply"); json.Bool(ctx.chaperone.autoApply);
+		json.Key("play_space_size"); json.FloatArray(ctx.chaperone.playSpaceSize.v, 2);
 
-		chaperone["standing_center"].set<picojson::array>(FloatArray(
-			(float *) ctx.chaperone.standingCenter.m,
-			sizeof(ctx.chaperone.standingCenter.m) / sizeof(float)
-		));
+		json.Key("standing_center");
+		json.FloatArray((const float *) ctx.chaperone.standingCenter.m, sizeof(ctx.chaperone.standingCenter.m) / sizeof(float));
 
-		chaperone["geometry"].set<picojson::array>(FloatArray(
-			(float *) ctx.chaperone.geometry.data(),
+		json.Key("geometry");
+		json.FloatArray(
+			(const float *) ctx.chaperone.geometry.data(),
 			sizeof(ctx.chaperone.geometry[0]) / sizeof(float) * ctx.chaperone.geometry.size()
-		));
-
-		profile["chaperone"].set<picojson::object>(chaperone);
+		);
+		json.EndObject();
 	}
 
-	picojson::value profileV;
-	profileV.set<picojson::object>(profile);
+	json.EndObject();
 
-	picojson::array profiles;
-	profiles.push_back(profileV);
+	for (auto &profile : stored)
+	{
+		if (profile.key == first.key)
+			continue;
+
+		json.BeginObject();
+		WriteCalibration(json, profile);
+		json.EndObject();
+	}
 
-	picojson::value profilesV;
-	profilesV.set<picojson::array>(profiles);
+	json.EndArray();
+	out += '\n';
+}
 
-	out << profilesV.serialize(true);
+static std::string ConfigDirectory()
+{
+	return std::string(getenv("HOME")) + "/.config/OpenVR-SpaceCalibrator";
 }
 
 static std::string ReadRegistryKey()
 {
-	FILE* config = fopen((std::string(getenv("HOME")) + "/.config/OpenVR-SpaceCalibrator/config.json").c_str(), "r");
+	FILE* config = fopen((ConfigDirectory() + "/config.json").c_str(), "r");
 	if (config == nullptr) {
 		std::cout << "Could not find config file" << std::endl;
 		return "";
@@ -218,37 +487,329 @@ static std::string ReadRegistryKey()
 	return contents;
 }
 
-static void WriteRegistryKey(std::string contents)
+// Replaces the config in one step: the contents go to a temporary file that is synced and then
+// renamed over config.json, so a crash mid-write leaves the previous config intact.
+static bool WriteRegistryKey(const std::string &contents)
 {
-	FILE* config = fopen((std::string(getenv("HOME")) + "/.config/OpenVR-SpaceCalibrator/config.json").c_str(), "w");
-	if (config == nullptr) {
-		std::cout << "Could not find config file" << std::endl;
-		return;
+	std::string directory = ConfigDirectory();
+	std::string path = directory + "/config.json", tempPath = path + ".tmp";
+
+	int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		std::cerr << "Could not create " << tempPath << ": " << strerror(errno) << std::endl;
+		return false;
 	}
-	size_t result = fwrite(contents.data(), contents.size(), 1, config);
-	fclose(config);
-	if (result == 0) {
-		std::cout << "Error occurred when reading config file" << std::endl;
+
+	size_t written = 0;
+	while (written < contents.size()) {
+		ssize_t result = write(fd, contents.data() + written, contents.size() - written);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			break;
+		written += result;
 	}
+
+	if (written != contents.size() || fsync(fd) == -1) {
+		std::cerr << "Error occurred when writing config file: " << strerror(errno) << std::endl;
+		close(fd);
+		unlink(tempPath.c_str());
+		return false;
+	}
+	close(fd);
+
+	if (rename(tempPath.c_str(), path.c_str()) == -1) {
+		std::cerr << "Could not replace config file: " << strerror(errno) << std::endl;
+		unlink(tempPath.c_str());
+		return false;
+	}
+
+	// Makes the rename itself durable
+	int dirFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirFd != -1) {
+		fsync(dirFd);
+		close(dirFd);
+	}
+	return true;
 }
 
-void LoadProfile(CalibrationContext &ctx)
+namespace {
+	// Writes serialized profiles on a background thread. Only the newest one matters, so a profile
+	// queued while another is waiting replaces it, and a profile identical to the last one written
+	// is dropped.
+	class ProfileWriter
+	{
+	public:
+		~ProfileWriter()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!thread.joinable())
+					return;
+				running = false;
+			}
+			wake.notify_one();
+			thread.join();
+		}
+
+		void Queue(std::string contents)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!thread.joinable())
+				thread = std::thread(&ProfileWriter::Run, this);
+
+			queued = std::move(contents);
+			hasQueued = true;
+			wake.notify_one();
+		}
+
+		// Blocks until everything queued so far is on disk
+		void Wait()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			idle.wait(lock, [this] { return !hasQueued && !writing; });
+		}
+
+		// The config as it was read from disk counts as written
+		void SetWritten(std::string contents)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			written = std::move(contents);
+		}
+
+		// Whether contents are what this writer last put on disk, or is putting there now
+		bool Wrote(const std::string &contents)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return contents == written || (writing && contents == current);
+		}
+
+	private:
+		void Run()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			for (;;)
+			{
+				wake.wait(lock, [this] { return hasQueued || !running; });
+				if (!hasQueued)
+					break;
+
+				current = std::move(queued);
+				hasQueued = false;
+
+				if (current != written)
+				{
+					writing = true;
+					lock.unlock();
+					bool saved = WriteRegistryKey(current);
+					lock.lock();
+					writing = false;
+					if (saved)
+						written = std::move(current);
+				}
+
+				if (!hasQueued)
+					idle.notify_all();
+			}
+		}
+
+		std::mutex mutex;
+		std::condition_variable wake, idle;
+		std::thread thread;
+		bool running = true;
+
+		std::string queued, current, written;
+		bool hasQueued = false, writing = false;
+	};
+
+	ProfileWriter profileWriter;
+
+	// Watches the config directory from a background thread; the file is replaced by rename, so
+	// watching the file itself would lose track of it after the first save. A config that changed
+	// on disk, other than by profileWriter, is parsed there and staged only if it is valid.
+	class ProfileWatcher
+	{
+	public:
+		~ProfileWatcher() { Stop(); }
+
+		void Start(std::function<void()> onChange)
+		{
+			if (thread.joinable())
+				return;
+
+			// So a config saved for the first time is seen too
+			std::error_code err;
+			std::filesystem::create_directories(ConfigDirectory(), err);
+
+			inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (inotifyFd == -1) {
+				std::cerr << "Could not watch the config file: " << strerror(errno) << std::endl;
+				return;
+			}
+			if (inotify_add_watch(inotifyFd, ConfigDirectory().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+				std::cerr << "Could not watch " << ConfigDirectory() << ": " << strerror(errno) << std::endl;
+				close(inotifyFd);
+				inotifyFd = -1;
+				return;
+			}
+			stopEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+			this->onChange = std::move(onChange);
+			thread = std::thread(&ProfileWatcher::Run, this);
+		}
+
+		void Stop()
+		{
+			if (!thread.joinable())
+				return;
+
+			uint64_t one = 1;
+			write(stopEvent, &one, sizeof(one));
+			thread.join();
+
+			close(inotifyFd);
+			close(stopEvent);
+			inotifyFd = stopEvent = -1;
+		}
+
+		bool HasStaged() const { return hasStaged; }
+
+		// Hands over the newest valid config that arrived since the last call
+		bool Take(std::string &contents)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!hasStaged)
+				return false;
+			contents = std::move(staged);
+			hasStaged = false;
+			return true;
+		}
+
+	private:
+		void Run()
+		{
+			pollfd fds[] = { { inotifyFd, POLLIN, 0 }, { stopEvent, POLLIN, 0 } };
+			for (;;)
+			{
+				if (poll(fds, 2, -1) == -1) {
+					if (errno == EINTR)
+						continue;
+					std::cerr << "Stopped watching the config file: " << strerror(errno) << std::endl;
+					return;
+				}
+				if (fds[1].revents)
+					return;
+
+				if (ConfigChanged())
+					Reload();
+			}
+		}
+
+		// Drains the pending events, reporting whether any of them was for config.json
+		bool ConfigChanged()
+		{
+			alignas(inotify_event) char buffer[4096];
+			bool changed = false;
+			ssize_t length;
+			while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+			{
+				for (char *ptr = buffer; ptr < buffer + length; )
+				{
+					auto event = (const inotify_event *) ptr;
+					if (event->len && strcmp(event->name, "config.json") == 0)
+						changed = true;
+					ptr += sizeof(inotify_event) + event->len;
+				}
+			}
+			return changed;
+		}
+
+		void Reload()
+		{
+			auto contents = ReadRegistryKey();
+			if (contents.empty() || profileWriter.Wrote(contents))
+				return;
+
+			try
+			{
+				CalibrationContext ctx;
+				ProfileStore store;
+				ParseProfile(ctx, store, contents);
+			}
+			catch (const std::runtime_error &e)
+			{
+				std::cerr << "Ignoring changed config: " << e.what() << std::endl;
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				staged = std::move(contents);
+				hasStaged = true;
+			}
+			if (onChange)
+				onChange();
+		}
+
+		std::thread thread;
+		int inotifyFd = -1, stopEvent = -1;
+		std::function<void()> onChange;
+
+		std::mutex mutex;
+		std::string staged;
+		std::atomic<bool> hasStaged = false;
+	};
+
+	ProfileWatcher profileWatcher;
+
+	// A requested save waits out this window, so a burst of changes is written once
+	const double SaveDebounceInterval = 2.0;
+	bool savePending = false;
+	double saveDeadline = 0.0;
+
+	void QueueProfileWrite(CalibrationContext &ctx)
+	{
+		savePending = false;
+
+		std::string contents;
+		WriteProfile(ctx, contents);
+		profileWriter.Queue(std::move(contents));
+	}
+}
+
+// Replaces the calibration and stored profiles with those in text, which came from disk. Returns
+// false if text is empty; ctx has no valid profile unless parsing succeeds.
+static bool ApplyProfile(CalibrationContext &ctx, const std::string &text)
 {
+	// The file on disk replaces whatever was waiting to be saved
+	savePending = false;
+	profileWriter.Wait();
+	profileWriter.SetWritten(text);
+
 	ctx.validProfile = false;
+	RecheckStoredProfile();
 
-	auto str = ReadRegistryKey();
-	if (str == "")
+	if (text == "")
 	{
-		std::cout << "Profile is empty" << std::endl;
 		ctx.Clear();
-		return;
+		Profiles.Clear();
+		return false;
 	}
 
+	ProfileStore store;
+	ParseProfile(ctx, store, text);
+	Profiles = std::move(store);
+	return true;
+}
+
+void LoadProfile(CalibrationContext &ctx)
+{
 	try
 	{
-		std::stringstream io(str);
-		ParseProfile(ctx, io);
-		std::cout << "Loaded profile" << std::endl;
+		if (ApplyProfile(ctx, ReadRegistryKey()))
+			std::cout << "Loaded profile" << std::endl;
+		else
+			std::cout << "Profile is empty" << std::endl;
 	}
 	catch (const std::runtime_error &e)
 	{
@@ -256,11 +817,59 @@ void LoadProfile(CalibrationContext &ctx)
 	}
 }
 
-void SaveProfile(CalibrationContext &ctx)
+void SaveProfile(CalibrationContext &)
+{
+	if (!savePending)
+	{
+		savePending = true;
+		saveDeadline = CalibrationClock() + SaveDebounceInterval;
+	}
+}
+
+void PollProfileSave(CalibrationContext &ctx, double time)
+{
+	if (savePending && time >= saveDeadline)
+		QueueProfileWrite(ctx);
+}
+
+void FlushProfile(CalibrationContext &ctx)
+{
+	if (savePending)
+		QueueProfileWrite(ctx);
+	profileWriter.Wait();
+}
+
+void StartProfileWatch(std::function<void()> onChange)
+{
+	profileWatcher.Start(std::move(onChange));
+}
+
+void StopProfileWatch()
+{
+	profileWatcher.Stop();
+}
+
+void PollProfileReload(CalibrationContext &ctx)
 {
-	std::cout << "Saving profile to registry" << std::endl;
+	static bool deferred = false;
+	if (!profileWatcher.HasStaged())
+		return;
+
+	// Swapping the calibration out from under a running calibration would undo its work
+	if (ctx.state != CalibrationState::None)
+	{
+		if (!deferred)
+			ctx.Log("Config changed on disk, reloading once calibration stops\n");
+		deferred = true;
+		return;
+	}
+	deferred = false;
+
+	std::string contents;
+	if (!profileWatcher.Take(contents))
+		return;
 
-	std::stringstream io;
-	WriteProfile(ctx, io);
-	WriteRegistryKey(io.str());
+	// Already parsed once by the watcher, so this can't fail halfway through
+	ApplyProfile(ctx, contents);
+	ctx.Log("Reloaded profile from disk\n");
 }
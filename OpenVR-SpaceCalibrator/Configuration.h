@@ -2,5 +2,22 @@
 
 #include "Calibration.h"
 
+#include <functional>
+
 void LoadProfile(CalibrationContext &ctx);
+
+// Requests a save. Requests within two seconds of the first are coalesced: the profile
+// is serialized once the window passes, on the next PollProfileSave, and written by a background
+// thread unless it matches what is already on disk.
 void SaveProfile(CalibrationContext &ctx);
+void PollProfileSave(CalibrationContext &ctx, double time);
+
+// Writes a pending save now and waits until it is on disk
+void FlushProfile(CalibrationContext &ctx);
+
+// Watches the config file for changes made outside this program, e.g. by hand or by deployment
+// tooling. A changed file is parsed off the main thread; if it is valid, onChange is called and
+// the next PollProfileReload swaps it in, or the first one after calibration stops.
+void StartProfileWatch(std::function<void()> onChange);
+void StopProfileWatch();
+void PollProfileReload(CalibrationContext &ctx);
@@ -0,0 +1,154 @@
+#include "DeviceRegistry.h"
+
+#include <algorithm>
+#include <cstdio>
+
+DeviceRegistry Devices;
+
+void DeviceRegistry::PollEvents()
+{
+	if (!vr::VRSystem())
+		return;
+
+	vr::VREvent_t vrEvent;
+	while (vr::VRSystem()->PollNextEvent(&vrEvent, sizeof(vrEvent)))
+	{
+		switch (vrEvent.eventType) {
+		case vr::VREvent_TrackedDeviceActivated:
+		case vr::VREvent_TrackedDeviceDeactivated:
+		case vr::VREvent_TrackedDeviceUpdated:
+		case vr::VREvent_TrackedDeviceRoleChanged:
+			if (vrEvent.trackedDeviceIndex < vr::k_unMaxTrackedDeviceCount)
+				dirtyMask |= 1ull << vrEvent.trackedDeviceIndex;
+			else
+				InvalidateAll();
+			break;
+		case vr::VREvent_Quit:
+			quitRequested = true;
+			break;
+		}
+	}
+}
+
+void DeviceRegistry::InvalidateAll()
+{
+	dirtyMask = ~0ull;
+}
+
+const VRState &DeviceRegistry::State()
+{
+	Refresh();
+
+	if (stateDirty)
+	{
+		state = VRState();
+		auto &trackingSystems = state.trackingSystems;
+
+		for (auto &entry : entries)
+		{
+			if (!entry.present || !entry.hasTrackingSystem || entry.device.deviceClass == vr::TrackedDeviceClass_TrackingReference)
+				continue;
+
+			const std::string &system = entry.device.trackingSystem;
+			auto existing = std::find(trackingSystems.begin(), trackingSystems.end(), system);
+			if (existing != trackingSystems.end())
+			{
+				if (entry.device.deviceClass == vr::TrackedDeviceClass_HMD)
+				{
+					trackingSystems.erase(existing);
+					trackingSystems.insert(trackingSystems.begin(), system);
+				}
+			}
+			else
+			{
+				trackingSystems.push_back(system);
+			}
+
+			state.devices.push_back(entry.device);
+		}
+		stateDirty = false;
+	}
+
+	return state;
+}
+
+const VRDevice *DeviceRegistry::Device(uint32_t id)
+{
+	if (id >= vr::k_unMaxTrackedDeviceCount)
+		return nullptr;
+
+	Refresh();
+	return entries[id].present ? &entries[id].device : nullptr;
+}
+
+uint64_t DeviceRegistry::Generation()
+{
+	Refresh();
+	return generation;
+}
+
+void DeviceRegistry::Refresh()
+{
+	if (!dirtyMask || !vr::VRSystem())
+		return;
+
+	bool changed = false;
+	for (uint32_t id = 0; id < vr::k_unMaxTrackedDeviceCount; ++id)
+	{
+		if (dirtyMask & (1ull << id))
+			changed |= LoadDevice(id, entries[id]);
+	}
+	dirtyMask = 0;
+
+	if (changed)
+	{
+		stateDirty = true;
+		generation++;
+	}
+}
+
+// Re-reads one device, returns whether anything differs from the cached entry
+bool DeviceRegistry::LoadDevice(uint32_t id, Entry &entry)
+{
+	Entry loaded;
+	loaded.device.id = id;
+	loaded.device.deviceClass = vr::VRSystem()->GetTrackedDeviceClass(id);
+	loaded.present = loaded.device.deviceClass != vr::TrackedDeviceClass_Invalid;
+
+	if (loaded.present)
+	{
+		char buffer[vr::k_unMaxPropertyStringSize];
+		vr::ETrackedPropertyError err = vr::TrackedProp_Success;
+
+		vr::VRSystem()->GetStringTrackedDeviceProperty(id, vr::Prop_TrackingSystemName_String, buffer, vr::k_unMaxPropertyStringSize, &err);
+		loaded.hasTrackingSystem = err == vr::TrackedProp_Success;
+
+		if (loaded.hasTrackingSystem)
+		{
+			loaded.device.trackingSystem = std::string(buffer);
+
+			vr::VRSystem()->GetStringTrackedDeviceProperty(id, vr::Prop_ModelNumber_String, buffer, vr::k_unMaxPropertyStringSize, &err);
+			loaded.device.model = err == vr::TrackedProp_Success ? std::string(buffer) : "";
+
+			vr::VRSystem()->GetStringTrackedDeviceProperty(id, vr::Prop_SerialNumber_String, buffer, vr::k_unMaxPropertyStringSize, &err);
+			loaded.device.serial = err == vr::TrackedProp_Success ? std::string(buffer) : "";
+
+			loaded.device.controllerRole = (vr::ETrackedControllerRole) vr::VRSystem()->GetInt32TrackedDeviceProperty(id, vr::Prop_ControllerRoleHint_Int32, &err);
+		}
+		else if (loaded.device.deviceClass != vr::TrackedDeviceClass_TrackingReference)
+		{
+			printf("failed to get tracking system name for id %d\n", id);
+		}
+	}
+
+	bool changed = loaded.present != entry.present
+		|| loaded.hasTrackingSystem != entry.hasTrackingSystem
+		|| loaded.device.deviceClass != entry.device.deviceClass
+		|| loaded.device.trackingSystem != entry.device.trackingSystem
+		|| loaded.device.model != entry.device.model
+		|| loaded.device.serial != entry.device.serial
+		|| loaded.device.controllerRole != entry.device.controllerRole;
+
+	entry = loaded;
+	return changed;
+}
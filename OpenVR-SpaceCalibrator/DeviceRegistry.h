@@ -0,0 +1,68 @@
+#pragma once
+
+#include <openvr.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct VRDevice
+{
+	int id = -1;
+	vr::TrackedDeviceClass deviceClass = vr::TrackedDeviceClass_Invalid;
+	std::string model = "";
+	std::string serial = "";
+	std::string trackingSystem = "";
+	vr::ETrackedControllerRole controllerRole = vr::TrackedControllerRole_Invalid;
+};
+
+struct VRState
+{
+	std::vector<std::string> trackingSystems;
+	std::vector<VRDevice> devices;
+};
+
+// Device properties cached per OpenVR ID. Reading string properties is an IPC round trip to
+// vrserver each, so a device is only re-read after SteamVR reports it activated, deactivated
+// or updated, instead of on every frame and every profile scan.
+class DeviceRegistry
+{
+public:
+	// Drains VRSystem events and invalidates the devices they name. Call once per tick.
+	void PollEvents();
+
+	// SteamVR asked applications to exit. Only seen here, since this drains the system queue.
+	bool QuitRequested() const { return quitRequested; }
+	void InvalidateAll();
+
+	// Connected devices that report a tracking system, excluding tracking references
+	const VRState &State();
+
+	// Class and properties of any connected device, or nullptr if the slot is empty
+	const VRDevice *Device(uint32_t id);
+
+	// Incremented whenever a re-read device differs from its cached copy
+	uint64_t Generation();
+
+private:
+	struct Entry
+	{
+		bool present = false;
+		bool hasTrackingSystem = false;
+		VRDevice device;
+	};
+
+	void Refresh();
+	bool LoadDevice(uint32_t id, Entry &entry);
+
+	Entry entries[vr::k_unMaxTrackedDeviceCount];
+	uint64_t dirtyMask = ~0ull;
+	bool stateDirty = true;
+	VRState state;
+	uint64_t generation = 0;
+	bool quitRequested = false;
+};
+
+static_assert(vr::k_unMaxTrackedDeviceCount <= 64, "dirtyMask holds one bit per device");
+
+extern DeviceRegistry Devices;
@@ -0,0 +1,388 @@
+#include "Headless.h"
+#include "Calibration.h"
+#include "Configuration.h"
+#include "DeviceRegistry.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+	// Commands longer than this are dropped along with the connection
+	const size_t MAX_COMMAND_LENGTH = 1024;
+
+	int WakeFd()
+	{
+		static int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		return fd;
+	}
+
+	struct ControlClient
+	{
+		int fd;
+		std::string input;
+	};
+
+	int listenSocket = -1;
+	std::string controlSocketPath;
+	std::vector<ControlClient> controlClients;
+	bool quit = false;
+
+	void OpenControlSocket()
+	{
+		const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+		if (!runtimeDir)
+		{
+			std::cerr << "XDG_RUNTIME_DIR is not set, running without a control socket" << std::endl;
+			return;
+		}
+
+		controlSocketPath = std::string(runtimeDir) + "/openvr-spacecal-control.sock";
+
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (controlSocketPath.size() >= sizeof(address.sun_path))
+		{
+			std::cerr << "Control socket path too long: " << controlSocketPath << std::endl;
+			return;
+		}
+		strncpy(address.sun_path, controlSocketPath.c_str(), sizeof(address.sun_path) - 1);
+
+		listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listenSocket == -1)
+		{
+			std::cerr << "Could not create control socket: " << strerror(errno) << std::endl;
+			return;
+		}
+
+		unlink(controlSocketPath.c_str());
+		if (bind(listenSocket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1 || listen(listenSocket, 4) == -1)
+		{
+			std::cerr << "Could not listen on " << controlSocketPath << ": " << strerror(errno) << std::endl;
+			close(listenSocket);
+			listenSocket = -1;
+			return;
+		}
+
+		std::cout << "Listening for commands on " << controlSocketPath << std::endl;
+	}
+
+	void CloseControlSocket()
+	{
+		for (auto &client : controlClients)
+			close(client.fd);
+		controlClients.clear();
+
+		if (listenSocket != -1)
+		{
+			close(listenSocket);
+			unlink(controlSocketPath.c_str());
+			listenSocket = -1;
+		}
+	}
+
+	const char *StateName(CalibrationState state)
+	{
+		switch (state)
+		{
+		case CalibrationState::None: return "idle";
+		case CalibrationState::Begin: return "starting";
+		case CalibrationState::Rotation: return "rotation";
+		case CalibrationState::Translation: return "translation";
+		case CalibrationState::Editing: return "editing";
+		case CalibrationState::Continuous: return "continuous";
+		case CalibrationState::ContinuousStandby: return "continuous-standby";
+		}
+		return "unknown";
+	}
+
+	std::string DeviceLabel(int32_t id)
+	{
+		auto device = id >= 0 ? Devices.Device(id) : nullptr;
+		if (!device)
+			return "none";
+		return std::to_string(id) + ":" + device->serial;
+	}
+
+	// Same default as the device lists in the UI: keep a present selection, otherwise prefer the
+	// left hand controller, otherwise the first device of the tracking system.
+	void SelectDefaultDevice(const VRState &state, int32_t &selected, const std::string &system)
+	{
+		auto inSystem = [&](const VRDevice &device) { return device.trackingSystem == system; };
+
+		bool present = std::any_of(state.devices.begin(), state.devices.end(), [&](const VRDevice &device) {
+			return inSystem(device) && device.id == selected;
+		});
+		if (present)
+			return;
+
+		selected = -1;
+		for (auto &device : state.devices)
+		{
+			if (!inSystem(device))
+				continue;
+			if (selected == -1 || device.controllerRole == vr::TrackedControllerRole_LeftHand)
+				selected = device.id;
+			if (device.controllerRole == vr::TrackedControllerRole_LeftHand)
+				break;
+		}
+	}
+
+	void SelectDefaultDevices()
+	{
+		// Like the UI, the selection is frozen while continuous calibration runs
+		if (CalCtx.state == CalibrationState::Continuous)
+			return;
+
+		auto &state = Devices.State();
+		if (CalCtx.referenceTrackingSystem.empty() && !state.trackingSystems.empty())
+			CalCtx.referenceTrackingSystem = state.trackingSystems.front();
+
+		if (CalCtx.targetTrackingSystem.empty())
+		{
+			for (auto &system : state.trackingSystems)
+			{
+				if (system != CalCtx.referenceTrackingSystem)
+				{
+					CalCtx.targetTrackingSystem = system;
+					break;
+				}
+			}
+		}
+
+		SelectDefaultDevice(state, CalCtx.referenceID, CalCtx.referenceTrackingSystem);
+		SelectDefaultDevice(state, CalCtx.targetID, CalCtx.targetTrackingSystem);
+	}
+
+	const VRDevice *FindBySerial(const std::string &serial)
+	{
+		for (auto &device : Devices.State().devices)
+		{
+			if (device.serial == serial)
+				return Devices.Device(device.id);
+		}
+		return nullptr;
+	}
+
+	std::string RunCommand(const std::string &line)
+	{
+		std::istringstream words(line);
+		std::string command;
+		words >> command;
+
+		if (command == "status")
+		{
+			std::ostringstream out;
+			out << "ok state=" << StateName(CalCtx.state)
+				<< " profile=" << (CalCtx.validProfile ? "valid" : "none")
+				<< " enabled=" << (CalCtx.enabled ? 1 : 0)
+				<< " reference=" << DeviceLabel(CalCtx.referenceID) << "@" << CalCtx.referenceTrackingSystem
+				<< " target=" << DeviceLabel(CalCtx.targetID) << "@" << CalCtx.targetTrackingSystem;
+
+			for (auto it = CalCtx.messages.rbegin(); it != CalCtx.messages.rend(); ++it)
+			{
+				if (it->type != CalibrationContext::Message::String)
+					continue;
+
+				std::string message = it->str;
+				while (!message.empty() && message.back() == '\n')
+					message.pop_back();
+				std::replace(message.begin(), message.end(), '\n', ' ');
+				out << " last=\"" << message << "\"";
+				break;
+			}
+			return out.str();
+		}
+
+		if (command == "select")
+		{
+			std::string referenceSerial, targetSerial;
+			if (!(words >> referenceSerial >> targetSerial))
+				return "error usage: select <reference serial> <target serial>";
+			if (CalCtx.state == CalibrationState::Continuous)
+				return "error selection is locked during continuous calibration";
+
+			auto reference = FindBySerial(referenceSerial), target = FindBySerial(targetSerial);
+			if (!reference || !target)
+				return "error no device with serial " + (reference ? targetSerial : referenceSerial);
+			if (reference->trackingSystem == target->trackingSystem)
+				return "error both devices are tracked by " + reference->trackingSystem;
+
+			CalCtx.referenceID = reference->id;
+			CalCtx.targetID = target->id;
+			CalCtx.referenceTrackingSystem = reference->trackingSystem;
+			CalCtx.targetTrackingSystem = target->trackingSystem;
+			return "ok";
+		}
+
+		if (command == "calibrate" || command == "start")
+		{
+			if (CalCtx.state != CalibrationState::None)
+				return std::string("error busy: ") + StateName(CalCtx.state);
+			if (CalCtx.referenceID == -1 || CalCtx.targetID == -1)
+				return "error no reference and target devices selected";
+
+			if (command == "start")
+				StartContinuousCalibration();
+			else
+				StartCalibration();
+			return "ok";
+		}
+
+		if (command == "stop")
+		{
+			if (CalCtx.state != CalibrationState::Continuous && CalCtx.state != CalibrationState::ContinuousStandby)
+				return "error continuous calibration is not running";
+			EndContinuousCalibration();
+			return "ok";
+		}
+
+		if (command == "reload")
+		{
+			if (CalCtx.state != CalibrationState::None)
+				return std::string("error busy: ") + StateName(CalCtx.state);
+			LoadProfile(CalCtx);
+			return "ok";
+		}
+
+		if (command == "quit")
+		{
+			quit = true;
+			return "ok";
+		}
+
+		return "error unknown command: " + command;
+	}
+
+	void AcceptControlClients()
+	{
+		for (;;)
+		{
+			int fd = accept4(listenSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd == -1)
+				return;
+			controlClients.push_back({ fd, std::string() });
+		}
+	}
+
+	// Returns false when the client should be disconnected
+	bool ServeControlClient(ControlClient &client)
+	{
+		char buffer[512];
+		for (;;)
+		{
+			ssize_t bytesRead = read(client.fd, buffer, sizeof(buffer));
+			if (bytesRead == 0)
+				return false;
+			if (bytesRead < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				return false;
+			}
+			client.input.append(buffer, bytesRead);
+		}
+
+		size_t newline;
+		while ((newline = client.input.find('\n')) != std::string::npos)
+		{
+			std::string line = client.input.substr(0, newline);
+			client.input.erase(0, newline + 1);
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if (line.empty())
+				continue;
+
+			// Replies are a single short line; a client that doesn't read them loses them
+			std::string reply = RunCommand(line) + "\n";
+			if (send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0 && errno != EAGAIN)
+				return false;
+		}
+
+		return client.input.size() <= MAX_COMMAND_LENGTH;
+	}
+}
+
+void WakeHeadless()
+{
+	uint64_t one = 1;
+	if (write(WakeFd(), &one, sizeof(one)) < 0 && errno != EAGAIN)
+		std::cerr << "Could not wake headless loop: " << strerror(errno) << std::endl;
+}
+
+void RunHeadless()
+{
+	OpenControlSocket();
+
+	while (!quit && !Devices.QuitRequested())
+	{
+		SelectDefaultDevices();
+		CalibrationTick(CalibrationClock());
+
+		std::vector<pollfd> fds;
+		fds.push_back({ WakeFd(), POLLIN, 0 });
+		if (listenSocket != -1)
+			fds.push_back({ listenSocket, POLLIN, 0 });
+		for (auto &client : controlClients)
+			fds.push_back({ client.fd, POLLIN, 0 });
+
+		// Waking before the tick gate opens again would only spin, e.g. when no interval is wanted
+		double wait = std::max(CalCtx.wantedUpdateInterval, CalCtx.timeLastTick + CalibrationTickInterval - CalibrationClock());
+		int timeoutMs = std::max(1, (int) std::ceil(wait * 1000.0));
+		if (poll(fds.data(), fds.size(), timeoutMs) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			std::cerr << "poll failed: " << strerror(errno) << std::endl;
+			break;
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			uint64_t count;
+			while (read(WakeFd(), &count, sizeof(count)) > 0) {}
+		}
+
+		size_t first = 1;
+		if (listenSocket != -1)
+		{
+			if (fds[1].revents & POLLIN)
+				AcceptControlClients();
+			first = 2;
+		}
+
+		// Polled clients come first in controlClients, accepted ones were appended after them
+		size_t polled = fds.size() - first;
+		for (size_t i = polled; i-- > 0;)
+		{
+			if (!fds[first + i].revents)
+				continue;
+
+			if (!ServeControlClient(controlClients[i]))
+			{
+				close(controlClients[i].fd);
+				controlClients.erase(controlClients.begin() + i);
+			}
+		}
+	}
+
+	if (CalCtx.state == CalibrationState::Continuous || CalCtx.state == CalibrationState::ContinuousStandby)
+		EndContinuousCalibration();
+
+	CloseControlSocket();
+}
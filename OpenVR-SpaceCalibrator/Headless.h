@@ -0,0 +1,18 @@
+#pragma once
+
+// Daemon mode for machines where nobody looks at the UI: no window, GL context or ImGui, just
+// CalibrationTick on a timer. Controlled with one-line text commands on a UNIX socket at
+// $XDG_RUNTIME_DIR/openvr-spacecal-control.sock, e.g. `echo status | socat - UNIX:<path>`:
+//
+//   status                          current state, devices and last log line
+//   select <reference> <target>     choose devices by serial number
+//   calibrate                       one-shot calibration
+//   start / stop                    continuous calibration
+//   reload                          reload the profile from disk
+//   quit                            exit
+
+// Thread safe. Makes RunHeadless tick before its timeout, e.g. when a pose pair is ready.
+void WakeHeadless();
+
+// Runs until SteamVR quits or a quit command arrives. The calibrator must be initialized.
+void RunHeadless();
@@ -1,13 +1,20 @@
 #include "IPCClient.h"
 
+#include <algorithm>
+#include <climits>
 #include <cstring>
 #include <stdexcept>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 #include <iostream>
 
+// How long Connect waits for the driver to answer the handshake
+static const time_t HandshakeTimeoutSeconds = 2;
+
 IPCClient::~IPCClient()
 {
 	if (fd != -1)
@@ -31,14 +38,32 @@ void IPCClient::Connect()
 		throw std::runtime_error("Space Calibrator driver unavailable. Make sure SteamVR is running, and the Space Calibrator addon is enabled in SteamVR settings.");
 	}
 
-	auto response = SendBlocking(protocol::Request(protocol::RequestHandshake));
-	if (response.type != protocol::ResponseHandshake || response.protocol.version != protocol::Version)
+	// A driver from before framed messages waits for a whole unframed request and never answers
+	// the handshake, so it gets a deadline instead of blocking startup forever
+	timeval timeout = { HandshakeTimeoutSeconds, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	protocol::Response response(protocol::ResponseInvalid);
+	bool answered = false;
+	SendAsync(protocol::Request(protocol::RequestHandshake), [&](const protocol::Response &r) {
+		response = r;
+		answered = true;
+	});
+	Flush();
+	while (!answered && ReadResponses(true))
+		;
+
+	timeval noTimeout = { 0, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &noTimeout, sizeof(noTimeout));
+
+	if (!answered || response.type != protocol::ResponseHandshake || response.protocol.version != protocol::Version)
 	{
+		inFlight.clear();
 		throw std::runtime_error(
 			"Incorrect driver version installed, try reinstalling OpenVR-SpaceCalibrator. (Client: " +
 			std::to_string(protocol::Version) +
 			", Driver: " +
-			std::to_string(response.protocol.version) +
+			(answered ? std::to_string(response.protocol.version) : std::string("no answer")) +
 			")"
 		);
 	}
@@ -46,32 +71,152 @@ void IPCClient::Connect()
 
 protocol::Response IPCClient::SendBlocking(const protocol::Request &request)
 {
-	Send(request);
-	return Receive();
+	protocol::Response response(protocol::ResponseInvalid);
+	bool done = false;
+
+	SendAsync(request, [&](const protocol::Response &r) {
+		response = r;
+		done = true;
+	});
+	Flush();
+
+	// Earlier pipelined responses are dispatched on the way
+	while (!done)
+		ReadResponses(true);
+
+	return response;
 }
 
-void IPCClient::Send(const protocol::Request &request)
+uint32_t IPCClient::SendAsync(const protocol::Request &request, Callback callback)
 {
-	ssize_t bytesWritten = write(fd, &request, sizeof request);
-	if (bytesWritten == -1)
-	{
-		throw std::runtime_error(std::string("Error writing IPC request. Error: ") + strerror(errno));
-	}
+	uint32_t id = nextRequestId++;
+	if (nextRequestId == 0)
+		nextRequestId = 1;
+
+	queued.push_back(request);
+	queued.back().requestId = id;
+	inFlight[id] = callback;
+	return id;
 }
 
-protocol::Response IPCClient::Receive()
+void IPCClient::Flush()
 {
-	protocol::Response response(protocol::ResponseInvalid);
-	ssize_t bytesRead = read(fd, &response, sizeof response);
-	if (bytesRead == -1)
+	static const char padding[8] = {};
+
+	// Header, payload and padding of everything queued since the last flush, in one writev
+	std::vector<protocol::MessageHeader> headers(queued.size());
+	std::vector<iovec> iov;
+	iov.reserve(queued.size() * 3);
+
+	for (size_t i = 0; i < queued.size(); i++)
 	{
-		throw std::runtime_error(std::string("Error reading IPC response. Error: ") + strerror(errno));
+		const void *payload;
+		size_t length = protocol::RequestPayload(queued[i], payload);
+
+		auto &header = headers[i];
+		header = {};
+		header.length = (uint32_t) length;
+		header.type = (uint16_t) queued[i].type;
+		header.version = (uint16_t) protocol::Version;
+		header.requestId = queued[i].requestId;
+
+		iov.push_back({ &header, sizeof(header) });
+		if (length)
+			iov.push_back({ const_cast<void *>(payload), length });
+		if (protocol::PaddedPayloadSize(length) != length)
+			iov.push_back({ const_cast<char *>(padding), protocol::PaddedPayloadSize(length) - length });
 	}
 
-	if (bytesRead != sizeof response)
+	size_t next = 0;
+	while (next < iov.size())
 	{
-		throw std::runtime_error("Invalid IPC response with size " + std::to_string(bytesRead));
+		int count = (int) std::min<size_t>(iov.size() - next, IOV_MAX);
+		ssize_t bytesWritten = writev(fd, iov.data() + next, count);
+		if (bytesWritten == -1 && errno == EINTR)
+			continue;
+		if (bytesWritten == -1)
+		{
+			queued.clear();
+			throw std::runtime_error(std::string("Error writing IPC request. Error: ") + strerror(errno));
+		}
+
+		// Skip what was written, resuming mid-buffer after a partial write
+		size_t remaining = bytesWritten;
+		while (next < iov.size() && remaining >= iov[next].iov_len)
+			remaining -= iov[next++].iov_len;
+		if (remaining)
+		{
+			iov[next].iov_base = static_cast<char *>(iov[next].iov_base) + remaining;
+			iov[next].iov_len -= remaining;
+		}
 	}
+	queued.clear();
+}
 
-	return response;
+void IPCClient::Poll()
+{
+	ReadResponses(false);
+}
+
+bool IPCClient::ReadResponses(bool block)
+{
+	char buffer[16384];
+	for (;;)
+	{
+		ssize_t bytesRead = recv(fd, buffer, sizeof buffer, block ? 0 : MSG_DONTWAIT);
+		if (bytesRead == -1 && errno == EINTR)
+			continue;
+		// Still blocking means no response arrived before the receive timeout
+		if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return !block;
+		if (bytesRead == -1)
+		{
+			throw std::runtime_error(std::string("Error reading IPC response. Error: ") + strerror(errno));
+		}
+		if (bytesRead == 0)
+		{
+			throw std::runtime_error("Driver closed the IPC connection with " + std::to_string(input.size()) + " bytes pending");
+		}
+		input.insert(input.end(), buffer, buffer + bytesRead);
+
+		// Decode everything complete before dispatching, as callbacks may send and read again
+		std::vector<protocol::Response> responses;
+		size_t consumed = 0;
+		while (input.size() - consumed >= sizeof(protocol::MessageHeader))
+		{
+			protocol::MessageHeader header;
+			memcpy(&header, input.data() + consumed, sizeof(header));
+
+			size_t frameSize = sizeof(header) + protocol::PaddedPayloadSize(header.length);
+			if (header.length > protocol::MaxPayloadSize)
+				throw std::runtime_error("Invalid IPC response with size " + std::to_string(header.length));
+			if (input.size() - consumed < frameSize)
+				break;
+
+			responses.emplace_back(protocol::ResponseInvalid);
+			if (!protocol::DecodeResponse(header, input.data() + consumed + sizeof(header), responses.back()))
+				throw std::runtime_error("Invalid IPC response " + std::to_string(header.type) + " with size " + std::to_string(header.length));
+			consumed += frameSize;
+		}
+		input.erase(input.begin(), input.begin() + consumed);
+
+		for (auto &response : responses)
+		{
+			auto it = inFlight.find(response.requestId);
+			if (it == inFlight.end())
+			{
+				std::cerr << "Dropping IPC response for unknown request " << response.requestId << std::endl;
+				continue;
+			}
+
+			auto callback = std::move(it->second);
+			inFlight.erase(it);
+			if (callback)
+				callback(response);
+		}
+
+		// A blocking read only waits for the first response; drain the rest without blocking
+		if (!responses.empty())
+			block = false;
+	}
 }
@@ -2,17 +2,42 @@
 
 #include "../Protocol.h"
 
+#include <functional>
+#include <map>
+#include <vector>
+
+// Connection to the driver. Requests can be queued with SendAsync and written together by
+// Flush; responses are matched to their requests by ID and handed to the completion callback
+// when Poll (or a later SendBlocking) reads them.
 class IPCClient
 {
 public:
+	typedef std::function<void(const protocol::Response &)> Callback;
+
 	~IPCClient();
 
 	void Connect();
 	protocol::Response SendBlocking(const protocol::Request &request);
 
-	void Send(const protocol::Request &request);
-	protocol::Response Receive();
+	// Queues a request and returns its ID. Nothing is written until Flush.
+	uint32_t SendAsync(const protocol::Request &request, Callback callback = nullptr);
+	void Flush();
+
+	// Dispatches the responses that have arrived so far, without blocking
+	void Poll();
+
+	size_t InFlight() const { return inFlight.size(); }
 
 private:
+	// Returns false if a blocking read timed out before any response arrived
+	bool ReadResponses(bool block);
+
 	int fd = -1;
-};
\ No newline at end of file
+	uint32_t nextRequestId = 1;
+
+	std::vector<protocol::Request> queued;
+	std::map<uint32_t, Callback> inFlight;
+
+	// Received bytes not yet forming a complete frame
+	std::vector<char> input;
+};
@@ -0,0 +1,474 @@
+#include "JsonStream.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+	// Deeper documents are rejected instead of recursing without bound in Skip
+	const size_t MaxDepth = 64;
+
+	void AppendEscaped(std::string &out, std::string_view text)
+	{
+		static const char hex[] = "0123456789abcdef";
+
+		out += '"';
+		for (char c : text)
+		{
+			switch (c)
+			{
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if ((unsigned char) c < 0x20)
+				{
+					out += "\\u00";
+					out += hex[(c >> 4) & 0xf];
+					out += hex[c & 0xf];
+				}
+				else
+					out += c;
+			}
+		}
+		out += '"';
+	}
+
+	template<typename T>
+	void AppendNumber(std::string &out, T value)
+	{
+		if (!std::isfinite(value))
+			throw std::runtime_error("cannot write a non-finite number to JSON");
+
+		char buffer[32];
+		auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+		out.append(buffer, result.ptr);
+	}
+
+	void AppendUtf8(std::string &out, uint32_t codepoint)
+	{
+		if (codepoint < 0x80)
+			out += (char) codepoint;
+		else if (codepoint < 0x800)
+		{
+			out += (char) (0xc0 | (codepoint >> 6));
+			out += (char) (0x80 | (codepoint & 0x3f));
+		}
+		else if (codepoint < 0x10000)
+		{
+			out += (char) (0xe0 | (codepoint >> 12));
+			out += (char) (0x80 | ((codepoint >> 6) & 0x3f));
+			out += (char) (0x80 | (codepoint & 0x3f));
+		}
+		else
+		{
+			out += (char) (0xf0 | (codepoint >> 18));
+			out += (char) (0x80 | ((codepoint >> 12) & 0x3f));
+			out += (char) (0x80 | ((codepoint >> 6) & 0x3f));
+			out += (char) (0x80 | (codepoint & 0x3f));
+		}
+	}
+
+	template<typename T>
+	void AppendArray(std::string &out, const T *values, size_t count)
+	{
+		out += '[';
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (i)
+				out += ", ";
+			AppendNumber(out, values[i]);
+		}
+		out += ']';
+	}
+}
+
+void JsonWriter::Newline()
+{
+	out += '\n';
+	out.append(empty.size() * 2, ' ');
+}
+
+void JsonWriter::BeginValue()
+{
+	if (afterKey)
+	{
+		afterKey = false;
+		return;
+	}
+
+	if (empty.empty())
+		return;
+
+	if (!empty.back())
+		out += ',';
+	empty.back() = false;
+	Newline();
+}
+
+void JsonWriter::BeginObject()
+{
+	BeginValue();
+	out += '{';
+	empty.push_back(true);
+}
+
+void JsonWriter::Close(char bracket)
+{
+	bool wasEmpty = empty.back();
+	empty.pop_back();
+	if (!wasEmpty)
+		Newline();
+	out += bracket;
+}
+
+void JsonWriter::EndObject()
+{
+	Close('}');
+}
+
+void JsonWriter::BeginArray()
+{
+	BeginValue();
+	out += '[';
+	empty.push_back(true);
+}
+
+void JsonWriter::EndArray()
+{
+	Close(']');
+}
+
+void JsonWriter::Key(std::string_view key)
+{
+	BeginValue();
+	AppendEscaped(out, key);
+	out += ": ";
+	afterKey = true;
+}
+
+void JsonWriter::String(std::string_view value)
+{
+	BeginValue();
+	AppendEscaped(out, value);
+}
+
+void JsonWriter::Number(double value)
+{
+	BeginValue();
+	AppendNumber(out, value);
+}
+
+void JsonWriter::Bool(bool value)
+{
+	BeginValue();
+	out += value ? "true" : "false";
+}
+
+void JsonWriter::FloatArray(const float *values, size_t count)
+{
+	BeginValue();
+	AppendArray(out, values, count);
+}
+
+void JsonWriter::DoubleArray(const double *values, size_t count)
+{
+	BeginValue();
+	AppendArray(out, values, count);
+}
+
+void JsonReader::Fail(const char *what)
+{
+	throw std::runtime_error(std::string(what) + " at offset " + std::to_string(pos - begin));
+}
+
+void JsonReader::SkipWhitespace()
+{
+	while (pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t'))
+		++pos;
+}
+
+void JsonReader::Expect(char c)
+{
+	SkipWhitespace();
+	if (pos == end || *pos != c)
+	{
+		char what[] = "expected ' '";
+		what[10] = c;
+		Fail(what);
+	}
+	++pos;
+}
+
+JsonReader::Type JsonReader::Peek()
+{
+	SkipWhitespace();
+	if (pos == end)
+		Fail("unexpected end of input");
+
+	switch (*pos)
+	{
+	case '{': return Type::Object;
+	case '[': return Type::Array;
+	case '"': return Type::String;
+	case 't': case 'f': return Type::Bool;
+	case 'n': return Type::Null;
+	case '-': return Type::Number;
+	default:
+		if (*pos >= '0' && *pos <= '9')
+			return Type::Number;
+		Fail("unexpected character");
+	}
+}
+
+void JsonReader::BeginObject()
+{
+	if (first.size() >= MaxDepth)
+		Fail("nesting too deep");
+	Expect('{');
+	first.push_back(true);
+}
+
+bool JsonReader::NextKey(std::string_view &key)
+{
+	SkipWhitespace();
+	if (pos < end && *pos == '}')
+	{
+		++pos;
+		first.pop_back();
+		return false;
+	}
+
+	if (!first.back())
+		Expect(',');
+	first.back() = false;
+
+	key = StringView();
+	Expect(':');
+	return true;
+}
+
+void JsonReader::BeginArray()
+{
+	if (first.size() >= MaxDepth)
+		Fail("nesting too deep");
+	Expect('[');
+	first.push_back(true);
+}
+
+bool JsonReader::NextElement()
+{
+	SkipWhitespace();
+	if (pos < end && *pos == ']')
+	{
+		++pos;
+		first.pop_back();
+		return false;
+	}
+
+	if (!first.back())
+		Expect(',');
+	first.back() = false;
+	return true;
+}
+
+std::string_view JsonReader::NumberText()
+{
+	if (Peek() != Type::Number)
+		Fail("expected number");
+
+	const char *start = pos;
+	while (pos < end && ((*pos >= '0' && *pos <= '9') || *pos == '-' || *pos == '+' || *pos == '.' || *pos == 'e' || *pos == 'E'))
+		++pos;
+	return std::string_view(start, pos - start);
+}
+
+double JsonReader::Double()
+{
+	auto text = NumberText();
+	double value;
+	auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+	if (result.ec != std::errc() || result.ptr != text.data() + text.size())
+		Fail("invalid number");
+	return value;
+}
+
+float JsonReader::Float()
+{
+	auto text = NumberText();
+	float value;
+	auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+	if (result.ec != std::errc() || result.ptr != text.data() + text.size())
+		Fail("invalid number");
+	return value;
+}
+
+void JsonReader::Literal(const char *literal)
+{
+	size_t length = strlen(literal);
+	if ((size_t) (end - pos) < length || memcmp(pos, literal, length) != 0)
+		Fail("invalid literal");
+	pos += length;
+}
+
+bool JsonReader::Bool()
+{
+	if (Peek() != Type::Bool)
+		Fail("expected boolean");
+
+	if (*pos == 't')
+	{
+		Literal("true");
+		return true;
+	}
+	Literal("false");
+	return false;
+}
+
+std::string_view JsonReader::StringView()
+{
+	Expect('"');
+
+	const char *start = pos;
+	while (pos < end && *pos != '"' && *pos != '\\')
+		++pos;
+	if (pos == end)
+		Fail("unterminated string");
+	if (*pos == '"')
+		return std::string_view(start, pos++ - start);
+
+	// Escapes need decoding, which happens in scratch from here on
+	scratch.assign(start, pos);
+
+	auto hexDigits = [this]() {
+		if (end - pos < 4)
+			Fail("truncated escape");
+		uint32_t value = 0;
+		for (int i = 0; i < 4; ++i, ++pos)
+		{
+			char c = *pos;
+			value <<= 4;
+			if (c >= '0' && c <= '9') value |= c - '0';
+			else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+			else Fail("invalid escape");
+		}
+		return value;
+	};
+
+	while (pos < end && *pos != '"')
+	{
+		if (*pos != '\\')
+		{
+			scratch += *pos++;
+			continue;
+		}
+
+		if (++pos == end)
+			break;
+
+		switch (*pos++)
+		{
+		case '"': scratch += '"'; break;
+		case '\\': scratch += '\\'; break;
+		case '/': scratch += '/'; break;
+		case 'b': scratch += '\b'; break;
+		case 'f': scratch += '\f'; break;
+		case 'n': scratch += '\n'; break;
+		case 'r': scratch += '\r'; break;
+		case 't': scratch += '\t'; break;
+		case 'u':
+		{
+			uint32_t codepoint = hexDigits();
+			if (codepoint >= 0xd800 && codepoint < 0xdc00 && end - pos >= 2 && pos[0] == '\\' && pos[1] == 'u')
+			{
+				pos += 2;
+				uint32_t low = hexDigits();
+				if (low < 0xdc00 || low >= 0xe000)
+					Fail("invalid surrogate pair");
+				codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+			}
+			AppendUtf8(scratch, codepoint);
+			break;
+		}
+		default:
+			--pos;
+			Fail("invalid escape");
+		}
+	}
+
+	if (pos == end)
+		Fail("unterminated string");
+	++pos;
+	return scratch;
+}
+
+std::string JsonReader::String()
+{
+	if (Peek() != Type::String)
+		Fail("expected string");
+	return std::string(StringView());
+}
+
+void JsonReader::Skip()
+{
+	std::string_view key;
+	switch (Peek())
+	{
+	case Type::Object:
+		BeginObject();
+		while (NextKey(key))
+			Skip();
+		break;
+	case Type::Array:
+		BeginArray();
+		while (NextElement())
+			Skip();
+		break;
+	case Type::String: StringView(); break;
+	case Type::Number: NumberText(); break;
+	case Type::Bool: Bool(); break;
+	case Type::Null: Literal("null"); break;
+	}
+}
+
+void JsonReader::FloatArray(float *values, size_t count)
+{
+	size_t read = 0;
+	BeginArray();
+	while (NextElement())
+	{
+		if (read == count)
+			Fail("too many values in array");
+		values[read++] = Float();
+	}
+
+	if (read != count)
+		Fail("too few values in array");
+}
+
+void JsonReader::DoubleArray(double *values, size_t count)
+{
+	size_t read = 0;
+	BeginArray();
+	while (NextElement())
+	{
+		if (read == count)
+			Fail("too many values in array");
+		values[read++] = Double();
+	}
+
+	if (read != count)
+		Fail("too few values in array");
+}
+
+void JsonReader::End()
+{
+	SkipWhitespace();
+	if (pos != end)
+		Fail("unexpected data after the end");
+}
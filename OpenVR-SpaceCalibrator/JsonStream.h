@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Minimal streaming JSON for the profile: the reader walks the text in place and hands values
+// straight to the caller, and the writer appends to a string, so neither builds a document tree.
+// Both throw std::runtime_error on malformed input or unrepresentable values.
+
+class JsonWriter
+{
+public:
+	explicit JsonWriter(std::string &out) : out(out) { }
+
+	void BeginObject();
+	void EndObject();
+	void BeginArray();
+	void EndArray();
+
+	void Key(std::string_view key);
+
+	void String(std::string_view value);
+	void Number(double value);
+	void Bool(bool value);
+
+	// Written on one line, in the shortest form that reads back as the same value
+	void FloatArray(const float *values, size_t count);
+	void DoubleArray(const double *values, size_t count);
+
+private:
+	void BeginValue();
+	void Newline();
+	void Close(char bracket);
+
+	std::string &out;
+
+	// One entry per open object or array: whether it has no members yet
+	std::vector<bool> empty;
+	bool afterKey = false;
+};
+
+class JsonReader
+{
+public:
+	enum class Type { Null, Bool, Number, String, Array, Object };
+
+	JsonReader(const char *begin, const char *end) : pos(begin), begin(begin), end(end) { }
+	explicit JsonReader(std::string_view text) : JsonReader(text.data(), text.data() + text.size()) { }
+
+	// Type of the next value, without consuming it
+	Type Peek();
+
+	void BeginObject();
+	// Reads the next member's key, or consumes the closing brace and returns false. The key
+	// stays valid until the next call on the reader.
+	bool NextKey(std::string_view &key);
+
+	void BeginArray();
+	// Returns false after consuming the closing bracket
+	bool NextElement();
+
+	double Double();
+	float Float();
+	bool Bool();
+	std::string String();
+	void Skip();
+
+	// Reads an array of exactly count numbers
+	void FloatArray(float *values, size_t count);
+	void DoubleArray(double *values, size_t count);
+
+	// Fails unless only whitespace is left
+	void End();
+
+private:
+	void SkipWhitespace();
+	[[noreturn]] void Fail(const char *what);
+	void Expect(char c);
+	std::string_view NumberText();
+	std::string_view StringView();
+	void Literal(const char *literal);
+
+	const char *pos, *begin, *end;
+
+	// Keys and strings with escapes are decoded here; plain ones point into the input
+	std::string scratch;
+
+	// One entry per open object or array: whether no member has been read yet
+	std::vector<bool> first;
+};
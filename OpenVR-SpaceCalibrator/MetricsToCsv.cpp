@@ -0,0 +1,136 @@
+// Converts metrics logs written during continuous calibration to CSV, one row per record:
+//
+//   spacecal-metrics-csv metrics-20240101-120000.scm [more.scm ...] > metrics.csv
+//
+// Vector series fill x, y and z; scalars and flags fill x only. Annotations have an empty
+// series and their text in the last column.
+
+#include "CalibrationMetrics.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+	std::string QuoteCsv(const std::string &text)
+	{
+		std::string quoted = "\"";
+		for (char c : text)
+		{
+			if (c == '"')
+				quoted += '"';
+			quoted += c;
+		}
+		return quoted + "\"";
+	}
+
+	bool ConvertLog(const char *path, FILE *out)
+	{
+		using namespace Metrics::LogFormat;
+
+		FILE *file = fopen(path, "rb");
+		if (!file)
+		{
+			std::cerr << path << ": could not open" << std::endl;
+			return false;
+		}
+
+		FileHeader fileHeader;
+		if (fread(&fileHeader, sizeof(fileHeader), 1, file) != 1 || memcmp(fileHeader.magic, Magic, sizeof(Magic)) != 0)
+		{
+			std::cerr << path << ": not a metrics log" << std::endl;
+			fclose(file);
+			return false;
+		}
+		if (fileHeader.version != Version)
+		{
+			std::cerr << path << ": unsupported version " << fileHeader.version << std::endl;
+			fclose(file);
+			return false;
+		}
+
+		std::vector<std::string> seriesNames;
+		std::vector<char> payload;
+		RecordHeader header;
+		bool ok = true;
+
+		while (fread(&header, sizeof(header), 1, file) == 1)
+		{
+			payload.resize(header.length);
+			if (header.length && fread(payload.data(), header.length, 1, file) != 1)
+			{
+				// The writer was killed in the middle of a batch; everything before it is intact
+				std::cerr << path << ": truncated record" << std::endl;
+				break;
+			}
+
+			std::string series = header.series < seriesNames.size() ? seriesNames[header.series] : std::to_string(header.series);
+			const double *values = reinterpret_cast<const double *>(payload.data());
+
+			switch (header.kind)
+			{
+			case SeriesName:
+				if (seriesNames.size() <= header.series)
+					seriesNames.resize(header.series + 1);
+				seriesNames[header.series].assign(payload.begin(), payload.end());
+				break;
+
+			case Scalar:
+				if (header.length != sizeof(double))
+					goto malformed;
+				fprintf(out, "%.6f,%s,%.17g,,,\n", header.time, series.c_str(), values[0]);
+				break;
+
+			case Vector3:
+				if (header.length != 3 * sizeof(double))
+					goto malformed;
+				fprintf(out, "%.6f,%s,%.17g,%.17g,%.17g,\n", header.time, series.c_str(), values[0], values[1], values[2]);
+				break;
+
+			case Flag:
+				if (header.length != 1)
+					goto malformed;
+				fprintf(out, "%.6f,%s,%d,,,\n", header.time, series.c_str(), payload[0] ? 1 : 0);
+				break;
+
+			case Annotation:
+				fprintf(out, "%.6f,,,,,%s\n", header.time, QuoteCsv(std::string(payload.begin(), payload.end())).c_str());
+				break;
+
+			default:
+				// Kinds added by newer versions are skipped
+				break;
+			}
+			continue;
+
+		malformed:
+			std::cerr << path << ": malformed " << series << " record" << std::endl;
+			ok = false;
+			break;
+		}
+
+		fclose(file);
+		return ok;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <metrics log> [...] > metrics.csv" << std::endl;
+		return 2;
+	}
+
+	fputs("time,series,x,y,z,annotation\n", stdout);
+
+	int status = 0;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!ConvertLog(argv[i], stdout))
+			status = 1;
+	}
+	return status;
+}
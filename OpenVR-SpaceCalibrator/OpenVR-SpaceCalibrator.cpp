@@ -1,6 +1,10 @@
 ﻿#include "Calibration.h"
+#include "CalibrationMetrics.h"
 #include "Configuration.h"
+#include "DeviceRegistry.h"
 #include "EmbeddedFiles.h"
+#include "Headless.h"
+#include "Scheduler.h"
 #include "UserInterface.h"
 
 #include <imgui.h>
@@ -35,6 +39,83 @@ static int fboTextureWidth = 0, fboTextureHeight = 0;
 
 static char cwd[PATH_MAX];
 
+// The UI is only rendered when something it shows may have changed: input, new log output or
+// progress, calibration state, devices or dashboard visibility. Anything else, like driver stats
+// or a held button, is picked up by a slow idle refresh.
+static const int RedrawFrames = 3; // ImGui needs a couple of frames to settle hover and popups
+static const double IdleRedrawInterval = 0.5;
+static int redrawFramesLeft = RedrawFrames;
+static double timeLastRedraw = 0;
+
+static void RequestRedraw()
+{
+	redrawFramesLeft = RedrawFrames;
+}
+
+// Installed instead of the ImGui backend's callbacks so input also requests a redraw
+static void GLFWMouseButtonCallback(GLFWwindow *window, int button, int action, int mods)
+{
+	ImGui_ImplGlfw_MouseButtonCallback(window, button, action, mods);
+	RequestRedraw();
+}
+
+static void GLFWScrollCallback(GLFWwindow *window, double xoffset, double yoffset)
+{
+	ImGui_ImplGlfw_ScrollCallback(window, xoffset, yoffset);
+	RequestRedraw();
+}
+
+static void GLFWKeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+	ImGui_ImplGlfw_KeyCallback(window, key, scancode, action, mods);
+	RequestRedraw();
+}
+
+static void GLFWCharCallback(GLFWwindow *window, unsigned int c)
+{
+	ImGui_ImplGlfw_CharCallback(window, c);
+	RequestRedraw();
+}
+
+static void GLFWCursorPosCallback(GLFWwindow *, double, double)
+{
+	RequestRedraw();
+}
+
+static void GLFWWindowRefreshCallback(GLFWwindow *)
+{
+	RequestRedraw();
+}
+
+struct UISnapshot
+{
+	CalibrationState state;
+	bool enabled, validProfile, dashboardVisible;
+	uint64_t messageRevision, devicesGeneration;
+	int32_t referenceID, targetID;
+
+	bool operator!=(const UISnapshot &other) const
+	{
+		return state != other.state
+			|| enabled != other.enabled
+			|| validProfile != other.validProfile
+			|| dashboardVisible != other.dashboardVisible
+			|| messageRevision != other.messageRevision
+			|| devicesGeneration != other.devicesGeneration
+			|| referenceID != other.referenceID
+			|| targetID != other.targetID;
+	}
+};
+
+static UISnapshot TakeUISnapshot(bool dashboardVisible)
+{
+	return {
+		CalCtx.state, CalCtx.enabled, CalCtx.validProfile, dashboardVisible,
+		CalCtx.messageRevision, Devices.Generation(),
+		CalCtx.referenceID, CalCtx.targetID,
+	};
+}
+
 void CreateGLFWWindow()
 {
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -71,7 +152,13 @@ void CreateGLFWWindow()
 	io.IniFilename = nullptr;
 	io.Fonts->AddFontFromMemoryCompressedTTF(DroidSans_compressed_data, DroidSans_compressed_size, 24.0f);
 
-	ImGui_ImplGlfw_InitForOpenGL(glfwWindow, true);
+	ImGui_ImplGlfw_InitForOpenGL(glfwWindow, false);
+	glfwSetMouseButtonCallback(glfwWindow, GLFWMouseButtonCallback);
+	glfwSetScrollCallback(glfwWindow, GLFWScrollCallback);
+	glfwSetKeyCallback(glfwWindow, GLFWKeyCallback);
+	glfwSetCharCallback(glfwWindow, GLFWCharCallback);
+	glfwSetCursorPosCallback(glfwWindow, GLFWCursorPosCallback);
+	glfwSetWindowRefreshCallback(glfwWindow, GLFWWindowRefreshCallback);
 	ImGui_ImplOpenGL3_Init("#version 330");
 
 	ImGui::StyleColorsDark();
@@ -187,7 +274,7 @@ void RunLoop()
 	{
 		TryCreateVROverlay();
 
-		double time = glfwGetTime();
+		double time = CalibrationClock();
 		CalibrationTick(time);
 
 		bool dashboardVisible = false;
@@ -235,6 +322,7 @@ void RunLoop()
 			vr::VREvent_t vrEvent;
 			while (vr::VROverlay()->PollNextOverlayEvent(overlayMainHandle, &vrEvent, sizeof(vrEvent)))
 			{
+				RequestRedraw();
 				switch (vrEvent.eventType) {
 				case vr::VREvent_MouseMove:
 					io.MousePos.x = vrEvent.data.mouse.x;
@@ -263,55 +351,71 @@ void RunLoop()
 			}
 		}
 
-		ImGui::GetIO().DisplaySize = ImVec2((float) fboTextureWidth, (float) fboTextureHeight);
+		static UISnapshot lastSnapshot = {};
+		auto snapshot = TakeUISnapshot(dashboardVisible);
+		if (snapshot != lastSnapshot)
+		{
+			lastSnapshot = snapshot;
+			RequestRedraw();
+		}
 
-		ImGui_ImplGlfw_SetReadMouseFromGlfw(!dashboardVisible);
-		ImGui_ImplOpenGL3_NewFrame();
-		ImGui_ImplGlfw_NewFrame();
-		ImGui::NewFrame();
+		if (redrawFramesLeft > 0 || (time - timeLastRedraw) >= IdleRedrawInterval)
+		{
+			if (redrawFramesLeft > 0)
+				redrawFramesLeft--;
+			timeLastRedraw = time;
 
-		BuildMainWindow(dashboardVisible);
+			ImGui::GetIO().DisplaySize = ImVec2((float) fboTextureWidth, (float) fboTextureHeight);
 
-		ImGui::Render();
+			ImGui_ImplGlfw_SetReadMouseFromGlfw(!dashboardVisible);
+			ImGui_ImplOpenGL3_NewFrame();
+			ImGui_ImplGlfw_NewFrame();
+			ImGui::NewFrame();
 
-		glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
-		glViewport(0, 0, fboTextureWidth, fboTextureHeight);
-		glClearColor(0, 0, 0, 1);
-		glClear(GL_COLOR_BUFFER_BIT);
+			BuildMainWindow(dashboardVisible);
 
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+			ImGui::Render();
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
+			glViewport(0, 0, fboTextureWidth, fboTextureHeight);
+			glClearColor(0, 0, 0, 1);
+			glClear(GL_COLOR_BUFFER_BIT);
 
-		if (width && height)
-		{
-			glBindFramebuffer(GL_READ_FRAMEBUFFER, fboHandle);
-			glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-			glfwSwapBuffers(glfwWindow);
-		}
+			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
-		if (dashboardVisible)
-		{
-			vr::Texture_t vrTex;
-			vrTex.eType = vr::TextureType_OpenGL;
-			vrTex.eColorSpace = vr::ColorSpace_Auto;
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+			if (width && height)
+			{
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, fboHandle);
+				glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+				glfwSwapBuffers(glfwWindow);
+			}
 
-			vrTex.handle = (void *)
+			if (dashboardVisible)
+			{
+				vr::Texture_t vrTex;
+				vrTex.eType = vr::TextureType_OpenGL;
+				vrTex.eColorSpace = vr::ColorSpace_Auto;
+
+				vrTex.handle = (void *)
 #if defined _WIN64 || defined _LP64
-			(uint64_t)
+				(uint64_t)
 #endif
-				fboTextureHandle;
+					fboTextureHandle;
 
-			vr::HmdVector2_t mouseScale = { (float) fboTextureWidth, (float) fboTextureHeight };
+				vr::HmdVector2_t mouseScale = { (float) fboTextureWidth, (float) fboTextureHeight };
 
-			vr::VROverlay()->SetOverlayTexture(overlayMainHandle, &vrTex);
-			vr::VROverlay()->SetOverlayMouseScale(overlayMainHandle, &mouseScale);
+				vr::VROverlay()->SetOverlayTexture(overlayMainHandle, &vrTex);
+				vr::VROverlay()->SetOverlayMouseScale(overlayMainHandle, &mouseScale);
+			}
 		}
 
 		const double dashboardInterval = 1.0 / 90.0; // fps
 		double waitEventsTimeout = CalCtx.wantedUpdateInterval;
 
-		if (dashboardVisible && waitEventsTimeout > dashboardInterval)
+		// Dashboard input arrives through polling, and pending redraws shouldn't wait for a tick
+		if ((dashboardVisible || redrawFramesLeft > 0) && waitEventsTimeout > dashboardInterval)
 			waitEventsTimeout = dashboardInterval;
 
 		glfwWaitEventsTimeout(waitEventsTimeout);
@@ -321,8 +425,34 @@ void RunLoop()
 int main(int argc, char** argv)
 {
 	getcwd(cwd, PATH_MAX);
+	bool headless = false;
 	for (int i = 1; i < argc; i++) {
-		HandleCommandLineArg(argv[i]);
+		if (strcmp(argv[i], "-headless") == 0 || strcmp(argv[i], "--headless") == 0)
+			headless = true;
+		else
+			HandleCommandLineArg(argv[i]);
+	}
+
+	if (headless)
+	{
+		try {
+			InitVR();
+			InitCalibrator(WakeHeadless);
+			LoadProfile(CalCtx);
+			StartProfileWatch(WakeHeadless);
+			RunHeadless();
+			StopProfileWatch();
+			FlushProfile(CalCtx);
+			Timers.Stop();
+			Metrics::StopLog();
+		}
+		catch (std::runtime_error &e)
+		{
+			std::cerr << "Runtime error: " << e.what() << std::endl;
+		}
+
+		vr::VR_Shutdown();
+		return 0;
 	}
 
 	if (!glfwInit())
@@ -336,10 +466,15 @@ int main(int argc, char** argv)
 	try {
 		InitVR();
 		CreateGLFWWindow();
-		InitCalibrator();
+		InitCalibrator(glfwPostEmptyEvent);
 		LoadProfile(CalCtx);
+		StartProfileWatch(glfwPostEmptyEvent);
 		RunLoop();
 
+		StopProfileWatch();
+		FlushProfile(CalCtx);
+		Timers.Stop();
+		Metrics::StopLog();
 		vr::VR_Shutdown();
 
 		if (fboHandle)
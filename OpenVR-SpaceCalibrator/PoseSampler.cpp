@@ -0,0 +1,185 @@
+#include "PoseSampler.h"
+
+#include <iostream>
+
+namespace {
+	// Pending pairs beyond this are dropped; the UI thread normally drains them every tick.
+	const size_t MAX_PENDING = 64;
+
+	double SampleTime(const timespec &ts)
+	{
+		return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+	}
+
+	uint64_t DeviceBit(int32_t id)
+	{
+		return (id >= 0 && id < (int32_t) vr::k_unMaxTrackedDeviceCount) ? (1ull << id) : 0;
+	}
+}
+
+PoseSampler::~PoseSampler()
+{
+	Stop();
+}
+
+bool PoseSampler::Start(std::function<void()> onSample)
+{
+	if (running)
+		return true;
+
+	if (!shmem.Open(OPENVR_SPACECALIBRATOR_SHMEM_NAME))
+	{
+		std::cerr << "Pose sampler disabled: could not open pose shared memory" << std::endl;
+		return false;
+	}
+
+	this->onSample = onSample;
+	running = true;
+	thread = std::thread(RunThread, this);
+	return true;
+}
+
+void PoseSampler::Stop()
+{
+	if (!running)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+		collecting = false;
+	}
+	collectChanged.notify_all();
+	shmem.Wake();
+	thread.join();
+	shmem.Close();
+}
+
+void PoseSampler::Collect(int32_t referenceID, int32_t targetID, double interval)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (collecting && this->referenceID == referenceID && this->targetID == targetID && this->interval == interval)
+			return;
+
+		this->referenceID = referenceID;
+		this->targetID = targetID;
+		this->interval = interval;
+		collecting = true;
+		pending.clear();
+	}
+
+	collectChanged.notify_all();
+	shmem.Wake();
+}
+
+void PoseSampler::StopCollecting()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!collecting)
+			return;
+
+		collecting = false;
+		pending.clear();
+	}
+
+	shmem.Wake();
+}
+
+bool PoseSampler::PopSample(PosePair &out)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (pending.empty())
+		return false;
+
+	out = pending.front();
+	pending.pop_front();
+	return true;
+}
+
+void PoseSampler::Discard()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	pending.clear();
+}
+
+void PoseSampler::RunThread(PoseSampler *_this)
+{
+	vr::DriverPose_t reference = {}, target = {};
+	bool referenceFresh = false, targetFresh = false;
+	int32_t referenceID = -1, targetID = -1;
+	double interval = 0.05, lastSampleTime = 0.0, latestTime = 0.0;
+
+	std::unique_lock<std::mutex> lock(_this->mutex);
+	while (_this->running)
+	{
+		if (!_this->collecting)
+		{
+			// Reader slot state is only touched from this thread
+			_this->shmem.SetWakeMask(0);
+			referenceID = targetID = -1;
+			_this->collectChanged.wait(lock, [_this] { return !_this->running || _this->collecting; });
+			_this->shmem.SkipToLatest();
+			referenceFresh = targetFresh = false;
+			continue;
+		}
+
+		if (referenceID != _this->referenceID || targetID != _this->targetID)
+		{
+			referenceFresh = targetFresh = false;
+			lastSampleTime = 0.0;
+			_this->shmem.SetWakeMask(DeviceBit(_this->referenceID) | DeviceBit(_this->targetID));
+		}
+		referenceID = _this->referenceID;
+		targetID = _this->targetID;
+		interval = _this->interval;
+
+		lock.unlock();
+
+		// The timeout only bounds how long a retarget or shutdown can go unnoticed if Wake() races.
+		_this->shmem.WaitForPoses(250);
+		_this->shmem.Heartbeat();
+		_this->shmem.ReadNewPoses([&](const protocol::DriverPoseShmem::AugmentedPose &augmented_pose) {
+			if (augmented_pose.deviceId == referenceID)
+			{
+				reference = augmented_pose.pose;
+				referenceFresh = true;
+			}
+			else if (augmented_pose.deviceId == targetID)
+			{
+				target = augmented_pose.pose;
+				targetFresh = true;
+			}
+			else
+			{
+				return;
+			}
+			latestTime = SampleTime(augmented_pose.sample_time);
+		});
+
+		bool captured = false;
+		lock.lock();
+
+		// Only pair poses that both arrived since the last sample, so the two devices are
+		// observed at (nearly) the same instant.
+		if (_this->collecting && referenceID == _this->referenceID && targetID == _this->targetID
+			&& referenceFresh && targetFresh && (latestTime - lastSampleTime) >= interval)
+		{
+			_this->pending.push_back({ reference, target, latestTime });
+			while (_this->pending.size() > MAX_PENDING)
+				_this->pending.pop_front();
+
+			referenceFresh = targetFresh = false;
+			lastSampleTime = latestTime;
+			captured = true;
+		}
+
+		if (captured && _this->onSample)
+		{
+			lock.unlock();
+			_this->onSample();
+			lock.lock();
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <openvr.h>
+#include "../Protocol.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Collects reference/target pose pairs on a dedicated thread. The thread sleeps on the pose
+// shared memory futex and is woken by the driver as soon as one of the two devices reports a
+// new pose, so samples are taken straight from the tracking update instead of the UI loop.
+class PoseSampler
+{
+public:
+	struct PosePair
+	{
+		vr::DriverPose_t reference, target;
+		double time;
+	};
+
+	~PoseSampler();
+
+	bool Start(std::function<void()> onSample);
+	void Stop();
+
+	bool IsRunning() const { return running; }
+
+	// Begins (or retargets) collection. At most one pair is captured per interval seconds.
+	void Collect(int32_t referenceID, int32_t targetID, double interval);
+	void StopCollecting();
+
+	bool PopSample(PosePair &out);
+	// Drops the pairs captured since the last PopSample, e.g. while tracking couldn't be trusted
+	void Discard();
+
+private:
+	static void RunThread(PoseSampler *_this);
+
+	protocol::DriverPoseShmem shmem;
+	std::thread thread;
+
+	std::mutex mutex;
+	std::condition_variable collectChanged;
+	bool running = false;
+	bool collecting = false;
+	int32_t referenceID = -1, targetID = -1;
+	double interval = 0.05;
+	std::deque<PosePair> pending;
+	std::function<void()> onSample;
+};
@@ -0,0 +1,129 @@
+#include "ProfileStore.h"
+
+#include <functional>
+
+ProfileStore Profiles;
+
+ProfileKey ProfileKey::FromContext(const CalibrationContext &ctx)
+{
+	return { ctx.referenceTrackingSystem, ctx.targetTrackingSystem, ctx.referenceSerial, ctx.targetSerial };
+}
+
+size_t ProfileKeyHash::operator()(const ProfileKey &key) const
+{
+	std::hash<std::string> hash;
+	size_t seed = 0;
+	for (auto *part : { &key.referenceTrackingSystem, &key.targetTrackingSystem, &key.referenceSerial, &key.targetSerial })
+		seed ^= hash(*part) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+	return seed;
+}
+
+StoredProfile StoredProfile::FromContext(const CalibrationContext &ctx)
+{
+	StoredProfile profile;
+	profile.key = ProfileKey::FromContext(ctx);
+	profile.calibratedRotation = ctx.calibratedRotation;
+	profile.calibratedTranslation = ctx.calibratedTranslation;
+	profile.calibratedScale = ctx.calibratedScale;
+	profile.refToTargetPose = ctx.refToTargetPose;
+	profile.relativePosCalibrated = ctx.relativePosCalibrated;
+	return profile;
+}
+
+void StoredProfile::ApplyTo(CalibrationContext &ctx) const
+{
+	ctx.referenceTrackingSystem = key.referenceTrackingSystem;
+	ctx.targetTrackingSystem = key.targetTrackingSystem;
+	ctx.referenceSerial = key.referenceSerial;
+	ctx.targetSerial = key.targetSerial;
+	ctx.calibratedRotation = calibratedRotation;
+	ctx.calibratedTranslation = calibratedTranslation;
+	ctx.calibratedScale = calibratedScale;
+	ctx.refToTargetPose = refToTargetPose;
+	ctx.relativePosCalibrated = relativePosCalibrated;
+	ctx.validProfile = true;
+}
+
+const StoredProfile *ProfileStore::Find(const ProfileKey &key) const
+{
+	auto it = index.find(key);
+	return it == index.end() ? nullptr : &profiles[it->second];
+}
+
+void ProfileStore::Put(const StoredProfile &profile)
+{
+	auto it = index.find(profile.key);
+	if (it != index.end())
+	{
+		profiles[it->second] = profile;
+		return;
+	}
+
+	size_t slot = profiles.size();
+	profiles.push_back(profile);
+	index.emplace(profile.key, slot);
+	if (profile.key.HasSerials())
+		byTargetSerial.emplace(profile.key.targetSerial, slot);
+}
+
+bool ProfileStore::Remove(const ProfileKey &key)
+{
+	auto it = index.find(key);
+	if (it == index.end())
+		return false;
+
+	profiles.erase(profiles.begin() + it->second);
+	Reindex();
+	return true;
+}
+
+void ProfileStore::Clear()
+{
+	profiles.clear();
+	index.clear();
+	byTargetSerial.clear();
+}
+
+void ProfileStore::Reindex()
+{
+	index.clear();
+	byTargetSerial.clear();
+	for (size_t slot = 0; slot < profiles.size(); ++slot)
+	{
+		index.emplace(profiles[slot].key, slot);
+		if (profiles[slot].key.HasSerials())
+			byTargetSerial.emplace(profiles[slot].key.targetSerial, slot);
+	}
+}
+
+const StoredProfile *ProfileStore::Match(const VRState &state, const ProfileKey &preferred) const
+{
+	std::unordered_map<std::string, const VRDevice *> connected;
+	for (auto &device : state.devices)
+		connected.emplace(device.serial, &device);
+
+	auto qualifies = [&connected](const ProfileKey &key) {
+		if (!key.HasSerials())
+			return false;
+		auto reference = connected.find(key.referenceSerial), target = connected.find(key.targetSerial);
+		return reference != connected.end() && target != connected.end()
+			&& reference->second->trackingSystem == key.referenceTrackingSystem
+			&& target->second->trackingSystem == key.targetTrackingSystem;
+	};
+
+	if (Find(preferred) && qualifies(preferred))
+		return Find(preferred);
+
+	// When several qualify, the one listed first in the config wins
+	size_t best = profiles.size();
+	for (auto &device : state.devices)
+	{
+		auto range = byTargetSerial.equal_range(device.serial);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (it->second < best && qualifies(profiles[it->second].key))
+				best = it->second;
+		}
+	}
+	return best < profiles.size() ? &profiles[best] : nullptr;
+}
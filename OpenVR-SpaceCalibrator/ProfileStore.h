@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Calibration.h"
+#include "CalibrationCalc.h"
+#include "DeviceRegistry.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Identifies a calibration by the devices it was made with. Profiles from before serials were
+// recorded have empty serials; they are kept, but never selected automatically.
+struct ProfileKey
+{
+	std::string referenceTrackingSystem, targetTrackingSystem;
+	std::string referenceSerial, targetSerial;
+
+	static ProfileKey FromContext(const CalibrationContext &ctx);
+
+	bool HasSerials() const { return !referenceSerial.empty() && !targetSerial.empty(); }
+
+	bool operator==(const ProfileKey &other) const
+	{
+		return referenceTrackingSystem == other.referenceTrackingSystem && targetTrackingSystem == other.targetTrackingSystem
+			&& referenceSerial == other.referenceSerial && targetSerial == other.targetSerial;
+	}
+	bool operator!=(const ProfileKey &other) const { return !(*this == other); }
+};
+
+struct ProfileKeyHash
+{
+	size_t operator()(const ProfileKey &key) const;
+};
+
+// The part of the context that belongs to one calibration; settings and chaperone bounds are global
+struct StoredProfile
+{
+	ProfileKey key;
+	Eigen::Vector3d calibratedRotation = Eigen::Vector3d::Zero();
+	Eigen::Vector3d calibratedTranslation = Eigen::Vector3d::Zero();
+	double calibratedScale = 1.0;
+	Eigen::AffineCompact3d refToTargetPose = Eigen::AffineCompact3d::Identity();
+	bool relativePosCalibrated = false;
+
+	// Left empty unless the calibration came from a continuous session
+	SolverState solverState;
+
+	static StoredProfile FromContext(const CalibrationContext &ctx);
+
+	// Makes this the active calibration
+	void ApplyTo(CalibrationContext &ctx) const;
+};
+
+// Every calibration the config file holds, one per key. Lookups by key are a single hash probe,
+// and matching against the connected devices costs one probe per device, so the right profile
+// can be picked whenever the device set changes.
+class ProfileStore
+{
+public:
+	const StoredProfile *Find(const ProfileKey &key) const;
+
+	// Adds the profile, or replaces the one with the same key
+	void Put(const StoredProfile &profile);
+	bool Remove(const ProfileKey &key);
+	void Clear();
+
+	// In insertion order
+	const std::vector<StoredProfile> &All() const { return profiles; }
+
+	// A profile whose reference and target devices are both connected, preferring the one keyed
+	// preferred if it qualifies. Returns nullptr if none does.
+	const StoredProfile *Match(const VRState &state, const ProfileKey &preferred) const;
+
+private:
+	void Reindex();
+
+	std::vector<StoredProfile> profiles;
+	std::unordered_map<ProfileKey, size_t, ProfileKeyHash> index;
+	std::unordered_multimap<std::string, size_t> byTargetSerial;
+};
+
+extern ProfileStore Profiles;
@@ -0,0 +1,165 @@
+#include "Scheduler.h"
+
+#include <openvr.h>
+
+#include <algorithm>
+
+TimerWheel Timers;
+
+constexpr TimerWheel::Duration TimerWheel::TickDuration;
+
+TimerWheel::~TimerWheel()
+{
+	Stop();
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(Duration delay, std::function<void()> action, Duration period, uint32_t count)
+{
+	if (count == 0)
+		return 0;
+
+	auto ticksFor = [](Duration duration) {
+		auto ticks = (duration.count() + TickDuration.count() - 1) / TickDuration.count();
+		return (uint64_t) std::max<int64_t>(ticks, 1);
+	};
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!running)
+	{
+		running = true;
+		thread = std::thread(RunThread, this);
+	}
+
+	TimerId id = nextId++;
+	Timer &timer = timers[id];
+	timer.action = std::move(action);
+	timer.periodTicks = ticksFor(period);
+	timer.remaining = count;
+	Insert(id, timer, ticksFor(delay));
+
+	wake.notify_one();
+	return id;
+}
+
+bool TimerWheel::Cancel(TimerId id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return timers.erase(id) != 0;
+}
+
+void TimerWheel::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!running)
+			return;
+
+		running = false;
+		timers.clear();
+		for (auto &slot : slots)
+			slot.clear();
+	}
+
+	wake.notify_one();
+	thread.join();
+}
+
+// Places the timer so it fires when the wheel reaches currentTick + ticks
+void TimerWheel::Insert(TimerId id, Timer &timer, uint64_t ticks)
+{
+	timer.rounds = (ticks - 1) / SlotCount;
+	slots[(currentTick + ticks) % SlotCount].push_back(id);
+}
+
+void TimerWheel::RunThread(TimerWheel *_this)
+{
+	std::vector<TimerId> due;
+	std::vector<std::pair<TimerId, std::function<void()>>> ready;
+
+	std::unique_lock<std::mutex> lock(_this->mutex);
+	_this->nextTickTime = std::chrono::steady_clock::now() + TickDuration;
+
+	while (_this->running)
+	{
+		if (_this->timers.empty())
+		{
+			_this->wake.wait(lock, [_this] { return !_this->running || !_this->timers.empty(); });
+
+			// Don't replay the ticks missed while idle
+			_this->nextTickTime = std::chrono::steady_clock::now() + TickDuration;
+			continue;
+		}
+
+		if (_this->wake.wait_until(lock, _this->nextTickTime, [_this] { return !_this->running; }))
+			break;
+
+		_this->currentTick++;
+		_this->nextTickTime += TickDuration;
+
+		due.clear();
+		due.swap(_this->slots[_this->currentTick % SlotCount]);
+
+		ready.clear();
+		for (TimerId id : due)
+		{
+			auto it = _this->timers.find(id);
+			if (it == _this->timers.end())
+				continue;
+
+			if (it->second.rounds > 0)
+			{
+				it->second.rounds--;
+				_this->slots[_this->currentTick % SlotCount].push_back(id);
+				continue;
+			}
+			ready.emplace_back(id, it->second.action);
+		}
+
+		if (ready.empty())
+			continue;
+
+		lock.unlock();
+		for (auto &entry : ready)
+			entry.second();
+		lock.lock();
+
+		for (auto &entry : ready)
+		{
+			// Cancelled while running
+			auto it = _this->timers.find(entry.first);
+			if (it == _this->timers.end())
+				continue;
+
+			if (--it->second.remaining == 0)
+				_this->timers.erase(it);
+			else
+				_this->Insert(entry.first, it->second, it->second.periodTicks);
+		}
+	}
+}
+
+static TimerWheel::TimerId hapticTimers[vr::k_unMaxTrackedDeviceCount];
+
+void PlayHapticPattern(int32_t deviceID, const HapticPattern &pattern)
+{
+	if (deviceID < 0 || deviceID >= (int32_t) vr::k_unMaxTrackedDeviceCount)
+		return;
+
+	CancelHapticPattern(deviceID);
+
+	unsigned short duration = pattern.pulseMicroseconds;
+	hapticTimers[deviceID] = Timers.Schedule(TimerWheel::Duration(0), [deviceID, duration] {
+		if (vr::VRSystem())
+			vr::VRSystem()->TriggerHapticPulse(deviceID, 0, duration);
+	}, pattern.interval, pattern.pulses);
+}
+
+void CancelHapticPattern(int32_t deviceID)
+{
+	if (deviceID < 0 || deviceID >= (int32_t) vr::k_unMaxTrackedDeviceCount)
+		return;
+
+	if (hapticTimers[deviceID])
+		Timers.Cancel(hapticTimers[deviceID]);
+	hapticTimers[deviceID] = 0;
+}
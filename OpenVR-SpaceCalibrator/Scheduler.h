@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Runs timed actions on a background thread, so the UI thread never sleeps for them. Timers
+// live in a hashed wheel of TickDuration slots; a timer further out than one revolution waits
+// out the extra rounds in its slot. The thread starts with the first timer and sleeps on a
+// condition variable while none are pending.
+class TimerWheel
+{
+public:
+	typedef uint64_t TimerId;
+	typedef std::chrono::milliseconds Duration;
+
+	static constexpr Duration TickDuration = Duration(5);
+	static const size_t SlotCount = 256;
+
+	~TimerWheel();
+
+	// Runs action after delay, then again every period until it has run count times. Delays are
+	// rounded up to whole ticks. Actions run on the timer thread and must not block for long.
+	TimerId Schedule(Duration delay, std::function<void()> action, Duration period = Duration(0), uint32_t count = 1);
+
+	// Returns false if the timer already finished. An action that is running right now completes,
+	// but does not repeat.
+	bool Cancel(TimerId id);
+
+	void Stop();
+
+private:
+	struct Timer
+	{
+		std::function<void()> action;
+		uint64_t periodTicks;
+		uint32_t remaining;
+		uint64_t rounds;
+	};
+
+	static void RunThread(TimerWheel *_this);
+	void Insert(TimerId id, Timer &timer, uint64_t ticks);
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::thread thread;
+	bool running = false;
+
+	uint64_t currentTick = 0;
+	std::chrono::steady_clock::time_point nextTickTime;
+	TimerId nextId = 1;
+
+	// Slots hold IDs only; a cancelled timer is dropped when its slot comes around
+	std::unordered_map<TimerId, Timer> timers;
+	std::vector<TimerId> slots[SlotCount];
+};
+
+extern TimerWheel Timers;
+
+struct HapticPattern
+{
+	uint32_t pulses;
+	TimerWheel::Duration interval;
+	unsigned short pulseMicroseconds;
+};
+
+// Vibrates a device, replacing whatever pattern it was playing. Call from the UI thread only.
+void PlayHapticPattern(int32_t deviceID, const HapticPattern &pattern);
+void CancelHapticPattern(int32_t deviceID);
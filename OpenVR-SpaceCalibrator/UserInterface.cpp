@@ -1,37 +1,84 @@
 #include "UserInterface.h"
 #include "Calibration.h"
+#include "CalibrationMetrics.h"
 #include "Configuration.h"
+#include "DeviceRegistry.h"
+#include "ProfileStore.h"
+#include "Scheduler.h"
 #include "../Version.h"
 
-#include <thread>
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <imgui.h>
 
-struct VRDevice
+void TextWithWidth(const char *label, const char *text, float width);
+
+template<typename T, typename F>
+void PlotSeries(const char *label, const Metrics::TimeSeries<T> &series, double since, F toValue)
 {
-	int id = -1;
-	vr::TrackedDeviceClass deviceClass;
-	std::string model = "";
-	std::string serial = "";
-	std::string trackingSystem = "";
-	vr::ETrackedControllerRole controllerRole = vr::TrackedControllerRole_Invalid;
-};
-
-struct VRState
+	std::vector<typename Metrics::TimeSeries<T>::Entry> entries;
+	series.Read(since, entries);
+
+	std::vector<float> values;
+	values.reserve(entries.size());
+	for (auto &entry : entries)
+		values.push_back((float) toValue(entry.value));
+
+	char overlay[64] = "no data";
+	if (!values.empty())
+		snprintf(overlay, sizeof overlay, "%.3f", values.back());
+
+	ImVec2 size(ImGui::GetWindowContentRegionWidth() * 0.6f, ImGui::GetTextLineHeight() * 3);
+	ImGui::PlotLines(label, values.data(), (int) values.size(), 0, overlay, FLT_MAX, FLT_MAX, size);
+}
+
+// Live solver metrics. Nothing is read from the series while the section is collapsed.
+void BuildCalibrationMetrics()
 {
-	std::vector<std::string> trackingSystems;
-	std::vector<VRDevice> devices;
-};
+	const double window = 30.0; // seconds
 
-void TextWithWidth(const char *label, const char *text, float width);
+	if (!ImGui::CollapsingHeader("Calibration metrics"))
+		return;
+
+	double since = Metrics::timestamp - window;
+	auto scalar = [](double value) { return value; };
+	auto length = [](const Eigen::Vector3d &value) { return value.norm(); };
+
+	PlotSeries("Current calibration error (mm)", Metrics::error_currentCal, since, scalar);
+	PlotSeries("New solve error (mm)", Metrics::error_rawComputed, since, scalar);
+	PlotSeries("Relative pose error (mm)", Metrics::error_byRelPose, since, scalar);
+	PlotSeries("Axis variance", Metrics::axisIndependence, since, scalar);
+	PlotSeries("Latest sample offset (mm)", Metrics::posOffset_lastSample, since, length);
+	PlotSeries("Compute time (ms)", Metrics::computationTime, since, scalar);
+
+	// Applied transforms per second over the window
+	const int bins = (int) window;
+	std::vector<Metrics::TimeSeries<bool>::Entry> applied;
+	Metrics::calibrationApplied.Read(since, applied);
+
+	std::vector<float> perSecond(bins, 0.0f);
+	int solvedCount = 0;
+	for (auto &entry : applied)
+	{
+		int bin = std::min(bins - 1, std::max(0, (int) (entry.time - since)));
+		perSecond[bin] += 1.0f;
+		if (entry.value)
+			solvedCount++;
+	}
+
+	char overlay[64];
+	snprintf(overlay, sizeof overlay, "%d solved, %d relative pose", solvedCount, (int) applied.size() - solvedCount);
+	ImVec2 size(ImGui::GetWindowContentRegionWidth() * 0.6f, ImGui::GetTextLineHeight() * 3);
+	ImGui::PlotHistogram("Applied calibrations", perSecond.data(), bins, 0, overlay, 0.0f, FLT_MAX, size);
+}
 
-VRState LoadVRState();
 void BuildSystemSelection(const VRState &state);
 void BuildDeviceSelections(const VRState &state);
 void BuildProfileEditor();
 void BuildMenu(bool runningInOverlay);
+void BuildDriverStats();
+void BuildCalibrationMetrics();
 
 static const ImGuiWindowFlags bareWindowFlags =
 	ImGuiWindowFlags_NoTitleBar |
@@ -53,7 +100,7 @@ void BuildMainWindow(bool runningInOverlay)
 
 	ImGui::PushStyleColor(ImGuiCol_PlotHistogram, ImGui::GetStyleColorVec4(ImGuiCol_Button));
 
-	auto state = LoadVRState();
+	auto &state = Devices.State();
 	BuildSystemSelection(state);
 	BuildDeviceSelections(state);
 	BuildMenu(runningInOverlay);
@@ -116,6 +163,7 @@ void BuildMenu(bool runningInOverlay)
 			ImGui::SameLine();
 			if (ImGui::Button("Clear Calibration", ImVec2(width * scale, ImGui::GetTextLineHeight() * 2)))
 			{
+				Profiles.Remove(ProfileKey::FromContext(CalCtx));
 				CalCtx.Clear();
 				SaveProfile(CalCtx);
 			}
@@ -169,6 +217,29 @@ void BuildMenu(bool runningInOverlay)
 			CalCtx.calibrationSpeed = CalibrationContext::VERY_SLOW;
 
 		ImGui::Columns(1);
+
+		if (ImGui::Checkbox(" Hide target device from SteamVR during continuous calibration", &CalCtx.quashTargetInContinuous))
+		{
+			SaveProfile(CalCtx);
+		}
+
+		if (CalCtx.quashTargetInContinuous)
+		{
+			ImGui::PushItemWidth(ImGui::GetWindowContentRegionWidth() * 0.25f);
+			if (ImGui::SliderInt(" Forward every Nth target update (0 = none)", &CalCtx.quashTargetForwardInterval, 0, 100))
+			{
+				SaveProfile(CalCtx);
+			}
+			ImGui::PopItemWidth();
+		}
+
+		if (ImGui::Checkbox(" Record calibration metrics to a log during continuous calibration", &CalCtx.recordMetrics))
+		{
+			SaveProfile(CalCtx);
+		}
+
+		ImGui::Text("");
+		BuildDriverStats();
 	}
 	else if (CalCtx.state == CalibrationState::Editing)
 	{
@@ -176,6 +247,7 @@ void BuildMenu(bool runningInOverlay)
 
 		if (ImGui::Button("Save Profile", ImVec2(ImGui::GetWindowContentRegionWidth(), ImGui::GetTextLineHeight() * 2)))
 		{
+			Profiles.Put(StoredProfile::FromContext(CalCtx));
 			SaveProfile(CalCtx);
 			CalCtx.state = CalibrationState::None;
 		}
@@ -185,6 +257,8 @@ void BuildMenu(bool runningInOverlay)
 		if (CalCtx.state == CalibrationState::Continuous)
 		{
 			ImGui::Button("Continuous calibration active...", ImVec2(ImGui::GetWindowContentRegionWidth(), ImGui::GetTextLineHeight() * 2));
+			ImGui::Text("");
+			BuildCalibrationMetrics();
 		}
 		else
 		{
@@ -236,6 +310,79 @@ void BuildMenu(bool runningInOverlay)
 	}
 }
 
+void BuildDriverStats()
+{
+	struct Row
+	{
+		std::string label;
+		protocol::DevicePoseStats stats;
+	};
+
+	static std::vector<Row> rows;
+	static double lastRequest = 0.0;
+	static bool firstReply = true;
+
+	if (!ImGui::CollapsingHeader("Driver pose hook latency"))
+	{
+		lastRequest = 0.0;
+		return;
+	}
+
+	// The driver reports per interval, so poll at a fixed rate while the section is open.
+	// Replies arrive through CalibrationTick, without stalling the frame on the driver.
+	double now = ImGui::GetTime();
+	if (lastRequest == 0.0 || now - lastRequest >= 1.0)
+	{
+		// The first reply after opening covers an unknown interval, skip it
+		firstReply = lastRequest == 0.0;
+		lastRequest = now;
+
+		RequestDriverStats([](const protocol::DriverStats &stats) {
+			if (firstReply)
+			{
+				firstReply = false;
+				rows.clear();
+				return;
+			}
+
+			rows.clear();
+			for (uint32_t id = 0; id < vr::k_unMaxTrackedDeviceCount; ++id)
+			{
+				if (stats.devices[id].poses == 0)
+					continue;
+
+				// Cached, so a refresh doesn't cost a vrserver round trip per device
+				auto device = Devices.Device(id);
+				bool known = device && !device->serial.empty();
+				rows.push_back({ std::to_string(id) + ": " + (known ? device->serial : "?"), stats.devices[id] });
+			}
+		});
+	}
+
+	if (rows.empty())
+	{
+		ImGui::Text("No pose updates yet");
+		return;
+	}
+
+	ImGui::Columns(5, "DriverStats", false);
+	ImGui::Text("Device"); ImGui::NextColumn();
+	ImGui::Text("Poses/s"); ImGui::NextColumn();
+	ImGui::Text("p50 (us)"); ImGui::NextColumn();
+	ImGui::Text("p99 (us)"); ImGui::NextColumn();
+	ImGui::Text("max (us)"); ImGui::NextColumn();
+
+	for (auto &row : rows)
+	{
+		ImGui::Text("%s", row.label.c_str()); ImGui::NextColumn();
+		ImGui::Text("%.0f", row.stats.posesPerSecond); ImGui::NextColumn();
+		ImGui::Text("%.1f", row.stats.p50Ns / 1000.0); ImGui::NextColumn();
+		ImGui::Text("%.1f", row.stats.p99Ns / 1000.0); ImGui::NextColumn();
+		ImGui::Text("%.1f", row.stats.maxNs / 1000.0); ImGui::NextColumn();
+	}
+	ImGui::Columns(1);
+}
+
 void BuildSystemSelection(const VRState &state)
 {
 	if (state.trackingSystems.empty())
@@ -476,12 +623,10 @@ void BuildDeviceSelections(const VRState &state)
 
 	if (ImGui::Button("Identify selected devices (blinks LED or vibrates)", ImVec2(ImGui::GetWindowContentRegionWidth(), ImGui::GetTextLineHeightWithSpacing() + 4.0f)))
 	{
-		for (unsigned i = 0; i < 100; ++i)
-		{
-			vr::VRSystem()->TriggerHapticPulse(CalCtx.targetID, 0, 2000);
-			vr::VRSystem()->TriggerHapticPulse(CalCtx.referenceID, 0, 2000);
-			std::this_thread::sleep_for(std::chrono::milliseconds(5));
-		}
+		// Half a second of 2 ms pulses, played from the timer thread
+		const HapticPattern identify = { 100, TimerWheel::Duration(5), 2000 };
+		PlayHapticPattern(CalCtx.targetID, identify);
+		PlayHapticPattern(CalCtx.referenceID, identify);
 	}
 
 	if (disableSelection)
@@ -490,65 +635,6 @@ void BuildDeviceSelections(const VRState &state)
 	}
 }
 
-VRState LoadVRState()
-{
-	VRState state;
-	auto &trackingSystems = state.trackingSystems;
-
-	char buffer[vr::k_unMaxPropertyStringSize];
-
-	for (uint32_t id = 0; id < vr::k_unMaxTrackedDeviceCount; ++id)
-	{
-		vr::ETrackedPropertyError err = vr::TrackedProp_Success;
-		auto deviceClass = vr::VRSystem()->GetTrackedDeviceClass(id);
-		if (deviceClass == vr::TrackedDeviceClass_Invalid)
-			continue;
-
-		if (deviceClass != vr::TrackedDeviceClass_TrackingReference)
-		{
-			vr::VRSystem()->GetStringTrackedDeviceProperty(id, vr::Prop_TrackingSystemName_String, buffer, vr::k_unMaxPropertyStringSize, &err);
-
-			if (err == vr::TrackedProp_Success)
-			{
-				std::string system(buffer);
-				auto existing = std::find(trackingSystems.begin(), trackingSystems.end(), system);
-				if (existing != trackingSystems.end())
-				{
-					if (deviceClass == vr::TrackedDeviceClass_HMD)
-					{
-						trackingSystems.erase(existing);
-						trackingSystems.insert(trackingSystems.begin(), system);
-					}
-				}
-				else
-				{
-					trackingSystems.push_back(system);
-				}
-
-				VRDevice device;
-				device.id = id;
-				device.deviceClass = deviceClass;
-				device.trackingSystem = system;
-
-				vr::VRSystem()->GetStringTrackedDeviceProperty(id, vr::Prop_ModelNumber_String, buffer, vr::k_unMaxPropertyStringSize, &err);
-				device.model = std::string(buffer);
-
-				vr::VRSystem()->GetStringTrackedDeviceProperty(id, vr::Prop_SerialNumber_String, buffer, vr::k_unMaxPropertyStringSize, &err);
-				device.serial = std::string(buffer);
-
-				device.controllerRole = (vr::ETrackedControllerRole) vr::VRSystem()->GetInt32TrackedDeviceProperty(id, vr::Prop_ControllerRoleHint_Int32, &err);
-				state.devices.push_back(device);
-			}
-			else
-			{
-				printf("failed to get tracking system name for id %d\n", id);
-			}
-		}
-	}
-
-	return state;
-}
-
 void BuildProfileEditor()
 {
 	ImGuiStyle &style = ImGui::GetStyle();
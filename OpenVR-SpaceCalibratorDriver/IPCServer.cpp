@@ -2,29 +2,88 @@
 #include "Logging.h"
 #include "ServerTrackedDeviceProvider.h"
 
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 
-void IPCServer::HandleRequest(const protocol::Request &request, protocol::Response &response)
+// Payloads are used in place from the client's input buffer, which keeps them 8-byte aligned.
+// Returns false for a malformed request, which drops the client.
+bool IPCServer::HandleRequest(const protocol::MessageHeader &header, const char *payload, protocol::Response &response)
 {
-	switch (request.type)
+	switch (header.type)
 	{
 	case protocol::RequestHandshake:
 		response.type = protocol::ResponseHandshake;
 		response.protocol.version = protocol::Version;
-		break;
+		return true;
 
 	case protocol::RequestSetDeviceTransform:
-		driver->SetDeviceTransform(request.setDeviceTransform);
+		if (header.length != sizeof(protocol::SetDeviceTransform))
+			break;
+		driver->SetDeviceTransform(*reinterpret_cast<const protocol::SetDeviceTransform *>(payload));
+		response.type = protocol::ResponseSuccess;
+		return true;
+
+	case protocol::RequestSetAlignmentSpeedParams:
+		if (header.length != sizeof(protocol::AlignmentSpeedParams))
+			break;
+		driver->SetAlignmentSpeedParams(*reinterpret_cast<const protocol::AlignmentSpeedParams *>(payload));
+		response.type = protocol::ResponseSuccess;
+		return true;
+
+	case protocol::RequestSetDeviceTransformBatch:
+	{
+		// Only the first count transforms are on the wire, and only those are read
+		auto batch = reinterpret_cast<const protocol::SetDeviceTransformBatch *>(payload);
+		if (header.length < protocol::BatchPayloadSize(0)
+			|| batch->count > vr::k_unMaxTrackedDeviceCount
+			|| header.length != protocol::BatchPayloadSize(batch->count))
+			break;
+		driver->SetDeviceTransformBatch(*batch);
 		response.type = protocol::ResponseSuccess;
-		break;
+		return true;
+	}
+
+	case protocol::RequestGetDeviceTransforms:
+		driver->GetDeviceTransforms(response.deviceTransforms);
+		response.type = protocol::ResponseDeviceTransforms;
+		return true;
+
+	case protocol::RequestGetDriverStats:
+		driver->GetDriverStats(response.driverStats);
+		response.type = protocol::ResponseDriverStats;
+		return true;
 
 	default:
-		LOG("Invalid IPC request: %d", request.type);
-		break;
+		LOG("Invalid IPC request: %d", header.type);
+		response.type = protocol::ResponseInvalid;
+		return true;
 	}
+
+	LOG("Malformed IPC request %d with %u byte payload", header.type, header.length);
+	return false;
+}
+
+void IPCServer::QueueResponse(Client &client, const protocol::Response &response)
+{
+	const void *payload;
+	size_t length = protocol::ResponsePayload(response, payload);
+
+	protocol::MessageHeader header = {};
+	header.length = (uint32_t) length;
+	header.type = (uint16_t) response.type;
+	header.version = (uint16_t) protocol::Version;
+	header.requestId = response.requestId;
+
+	auto &out = client.output;
+	size_t start = out.size();
+	out.resize(start + sizeof(header) + protocol::PaddedPayloadSize(length));
+	memcpy(out.data() + start, &header, sizeof(header));
+	if (length)
+		memcpy(out.data() + start + sizeof(header), payload, length);
+	memset(out.data() + start + sizeof(header) + length, 0, protocol::PaddedPayloadSize(length) - length);
 }
 
 IPCServer::~IPCServer()
@@ -34,14 +93,27 @@ IPCServer::~IPCServer()
 
 void IPCServer::Run()
 {
-	int fds[2];
-	int result = pipe(fds);
-	if (result == -1) {
-		LOG("Could not create stop pipe: %s", strerror(errno));
+	stopEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (stopEvent == -1) {
+		LOG("Could not create stop event: %s", strerror(errno));
 		return;
 	}
-	stopRead = fds[0];
-	stopWrite = fds[1];
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd == -1) {
+		LOG("Could not create epoll instance: %s", strerror(errno));
+		close(stopEvent);
+		stopEvent = -1;
+		return;
+	}
+
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = stopEvent;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, stopEvent, &event);
+
+	stop = false;
+	running = true;
 	mainThread = std::thread(RunThread, this);
 }
 
@@ -51,21 +123,175 @@ void IPCServer::Stop()
 	if (!running)
 		return;
 
+	// Signal first, so an idle epoll_wait returns and the thread can be joined
 	stop = true;
+	uint64_t one = 1;
+	write(stopEvent, &one, sizeof(one));
 	mainThread.join();
 	running = false;
-	write(stopWrite, &stop, 1);
-	close(stopRead);
-	close(stopWrite);
+
+	close(epollFd);
+	close(stopEvent);
+	epollFd = stopEvent = -1;
 	TRACE("IPCServer::Stop() finished");
 }
 
-void IPCServer::RunThread(IPCServer *_this)
+bool IPCServer::AcceptClients()
+{
+	for (;;)
+	{
+		int clientSocket = accept4(serverSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (clientSocket == -1)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			LOG("accept failed in RunThread. Error: %s", strerror(errno));
+			// Out of descriptors and similar; back off instead of spinning on a ready listener
+			return errno != EMFILE && errno != ENFILE;
+		}
+
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.fd = clientSocket;
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientSocket, &event) == -1)
+		{
+			LOG("Could not watch IPC client: %s", strerror(errno));
+			close(clientSocket);
+			continue;
+		}
+
+		clients[clientSocket].socket = clientSocket;
+		LOG("IPC client connected (%zu connected)", clients.size());
+	}
+}
+
+bool IPCServer::ReadClient(Client &client)
 {
-	_this->running = true;
+	char buffer[16384];
+	bool closed = false;
+	for (;;)
+	{
+		ssize_t bytesRead = read(client.socket, buffer, sizeof(buffer));
+		if (bytesRead == -1 && errno == EINTR)
+			continue;
+		if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (bytesRead == 0)
+		{
+			// A client may send a batch and shut down its write side; its requests still count
+			closed = true;
+			break;
+		}
+		if (bytesRead == -1)
+		{
+			LOG("IPC client disconnecting due to error, error: %s", strerror(errno));
+			return false;
+		}
+		client.input.insert(client.input.end(), buffer, buffer + bytesRead);
+	}
+
+	// Every complete request gets its response queued in order
+	size_t consumed = 0;
+	while (client.input.size() - consumed >= sizeof(protocol::MessageHeader))
+	{
+		auto header = reinterpret_cast<const protocol::MessageHeader *>(client.input.data() + consumed);
+		if (header->length > protocol::MaxPayloadSize)
+		{
+			LOG("IPC client sent an oversized message (%u bytes), disconnecting", header->length);
+			return false;
+		}
+
+		size_t frameSize = sizeof(protocol::MessageHeader) + protocol::PaddedPayloadSize(header->length);
+		if (client.input.size() - consumed < frameSize)
+			break;
 
-	int serverSocket = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (serverSocket == -1) {
+		protocol::Response response;
+		response.requestId = header->requestId;
+
+		// A client built for another protocol version only gets to learn ours
+		if (header->version != protocol::Version)
+		{
+			LOG("IPC client uses protocol version %d, disconnecting", header->version);
+			response.type = protocol::ResponseHandshake;
+			response.protocol.version = protocol::Version;
+			QueueResponse(client, response);
+			FlushClient(client);
+			return false;
+		}
+
+		if (!HandleRequest(*header, client.input.data() + consumed + sizeof(protocol::MessageHeader), response))
+			return false;
+
+		consumed += frameSize;
+		QueueResponse(client, response);
+	}
+	client.input.erase(client.input.begin(), client.input.begin() + consumed);
+
+	if (closed)
+	{
+		// Best effort: responses that don't fit in the socket buffer are dropped with the client
+		FlushClient(client);
+		LOG("IPC client disconnecting normally");
+		return false;
+	}
+
+	return FlushClient(client);
+}
+
+bool IPCServer::FlushClient(Client &client)
+{
+	while (client.outputSent < client.output.size())
+	{
+		ssize_t bytesWritten = send(client.socket, client.output.data() + client.outputSent,
+			client.output.size() - client.outputSent, MSG_NOSIGNAL);
+		if (bytesWritten == -1 && errno == EINTR)
+			continue;
+		if (bytesWritten == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (bytesWritten == -1)
+		{
+			if (errno == ECONNRESET || errno == EPIPE)
+				LOG("IPC client disconnecting normally");
+			else
+				LOG("IPC client disconnecting due to error, error: %s", strerror(errno));
+			return false;
+		}
+		client.outputSent += bytesWritten;
+	}
+
+	if (client.outputSent == client.output.size())
+	{
+		client.output.clear();
+		client.outputSent = 0;
+	}
+
+	// Only ask for EPOLLOUT while a response is stuck behind a full socket buffer
+	bool wantsWrite = !client.output.empty();
+	if (wantsWrite != client.wantsWrite)
+	{
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLRDHUP | (wantsWrite ? (uint32_t) EPOLLOUT : 0u);
+		event.data.fd = client.socket;
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, client.socket, &event);
+		client.wantsWrite = wantsWrite;
+	}
+	return true;
+}
+
+void IPCServer::CloseClient(int socket)
+{
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, socket, nullptr);
+	close(socket);
+	clients.erase(socket);
+}
+
+void IPCServer::RunThread(IPCServer *_this)
+{
+	_this->serverSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (_this->serverSocket == -1) {
 		LOG("socket failed in RunThread. Error: %s", strerror(errno));
 		return;
 	}
@@ -75,68 +301,80 @@ void IPCServer::RunThread(IPCServer *_this)
 	memset(&serverAddress, 0, sizeof(struct sockaddr_un));
 	serverAddress.sun_family = AF_UNIX;
 	strncpy(serverAddress.sun_path, socketPath.data(), socketPath.size());
-	int result = bind(serverSocket, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress));
+	int result = bind(_this->serverSocket, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress));
 	if (result == -1)
 	{
-		close(serverSocket);
+		close(_this->serverSocket);
 		LOG("bind failed in RunThread. Error: %s", strerror(errno));
 		return;
 	}
-	result = listen(serverSocket, 5);
+	result = listen(_this->serverSocket, 16);
 	if (result == -1)
 	{
-		close(serverSocket);
+		close(_this->serverSocket);
 		LOG("listen failed in RunThread. Error: %s", strerror(errno));
 		return;
 	}
 
+	epoll_event listenEvent = {};
+	listenEvent.events = EPOLLIN;
+	listenEvent.data.fd = _this->serverSocket;
+	epoll_ctl(_this->epollFd, EPOLL_CTL_ADD, _this->serverSocket, &listenEvent);
+
+	bool listening = true;
+	epoll_event events[32];
 	while (!_this->stop)
 	{
-		if (_this->stop)
+		// While accept is failing for lack of descriptors, poll the listener again periodically
+		int count = epoll_wait(_this->epollFd, events, 32, listening ? -1 : 100);
+		if (count == -1)
 		{
+			if (errno == EINTR)
+				continue;
+			LOG("epoll_wait failed in RunThread. Error: %s", strerror(errno));
 			break;
 		}
 
-		int clientSocket = accept(serverSocket, nullptr, nullptr);
-		if (clientSocket == -1) {
-			LOG("accept failed in RunThread. Error: %s", strerror(errno));
-			continue;
+		if (!listening)
+		{
+			listening = true;
+			epoll_ctl(_this->epollFd, EPOLL_CTL_ADD, _this->serverSocket, &listenEvent);
 		}
 
-		LOG("IPC client connected");
-
-		struct pollfd fds[2];
-		fds[0].fd = _this->stopRead;
-		fds[0].events = POLLIN | POLLRDBAND;
-		fds[1].fd = clientSocket;
-		fds[1].events = POLLIN | POLLRDBAND;
-
-		while (poll(fds, 2, -1) != -1) {
-			if (fds[0].revents != 0) {
-				break;
-			}
-			if (fds[1].revents == 0) {
-				continue;
-			}
-			protocol::Request request;
-			ssize_t bytesRead = read(clientSocket, &request, sizeof(request));
-			if (bytesRead != sizeof(request)) {
-				LOG("IPC client disconnecting due to error (via CompletedWriteCallback), error: %s, bytesRead: %zd", strerror(errno), bytesRead);
+		for (int i = 0; i < count; i++)
+		{
+			int fd = events[i].data.fd;
+			if (fd == _this->stopEvent)
 				break;
-			}
-			protocol::Response response;
-			_this->HandleRequest(request, response);
-			ssize_t bytesWritten = write(clientSocket, &response, sizeof(response));
-			if (bytesWritten != sizeof(response)) {
-				if (bytesWritten == -1 && errno == ECONNRESET) {
-					LOG("IPC client disconnecting normally");
-				} else {
-					LOG("IPC client disconnecting due to error (via CompletedReadCallback), error: %s, bytesWritten: %zd", strerror(errno), bytesWritten);
+
+			if (fd == _this->serverSocket)
+			{
+				if (!_this->AcceptClients())
+				{
+					listening = false;
+					epoll_ctl(_this->epollFd, EPOLL_CTL_DEL, _this->serverSocket, nullptr);
 				}
-				break;
+				continue;
 			}
+
+			auto it = _this->clients.find(fd);
+			if (it == _this->clients.end())
+				continue;
+
+			bool keep = true;
+			if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				keep = _this->ReadClient(it->second);
+			else if (events[i].events & EPOLLOUT)
+				keep = _this->FlushClient(it->second);
+
+			if (!keep)
+				_this->CloseClient(fd);
 		}
 	}
 
-	close(serverSocket);
+	while (!_this->clients.empty())
+		_this->CloseClient(_this->clients.begin()->first);
+
+	close(_this->serverSocket);
+	_this->serverSocket = -1;
 }
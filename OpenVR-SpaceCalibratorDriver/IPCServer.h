@@ -2,9 +2,10 @@
 
 #include "../Protocol.h"
 
+#include <atomic>
+#include <map>
 #include <thread>
-#include <set>
-#include <mutex>
+#include <vector>
 
 class ServerTrackedDeviceProvider;
 
@@ -18,28 +19,35 @@ public:
 	void Stop();
 
 private:
-	void HandleRequest(const protocol::Request &request, protocol::Response &response);
+	bool HandleRequest(const protocol::MessageHeader &header, const char *payload, protocol::Response &response);
 
-	struct SocketInstance
+	// A connected client. Sockets are non-blocking, so partial messages stay in the buffers
+	// until the rest arrives or the socket is writable again.
+	struct Client
 	{
-		int clientSocket;
-		IPCServer *server;
-
-		protocol::Request request;
-		protocol::Response response;
+		int socket;
+		std::vector<char> input;
+		std::vector<char> output;
+		size_t outputSent = 0;
+		bool wantsWrite = false;
 	};
 
-	SocketInstance *CreateSocketInstance(int fd);
-	void CloseSocketInstance(SocketInstance *pipeInst);
+	void QueueResponse(Client &client, const protocol::Response &response);
+	bool AcceptClients();
+	bool ReadClient(Client &client);
+	bool FlushClient(Client &client);
+	void CloseClient(int socket);
 
 	static void RunThread(IPCServer *_this);
 
 	std::thread mainThread;
 
 	bool running = false;
-	bool stop = false;
-	int stopRead = -1;
-	int stopWrite = -1;
+	std::atomic<bool> stop = { false };
+	int stopEvent = -1;
+	int epollFd = -1;
+	int serverSocket = -1;
+	std::map<int, Client> clients;
 
 	ServerTrackedDeviceProvider *driver;
 };
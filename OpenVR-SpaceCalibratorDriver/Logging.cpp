@@ -1,27 +1,289 @@
 #include "Logging.h"
-#include <chrono>
+
+#include <pthread.h>
+#include <string>
+
+// Relative to vrserver's working directory. Builds that load the driver code elsewhere, like the
+// benchmarks, point it somewhere else.
+#ifndef OPENVR_SPACECALIBRATOR_DRIVER_LOG_NAME
+#define OPENVR_SPACECALIBRATOR_DRIVER_LOG_NAME "space_calibrator_driver.log"
+#endif
 
 FILE *LogFile;
 
+namespace {
+	const uint64_t RING_SIZE = 1024; // power of two
+	const long IDLE_SLEEP_NS = 50 * 1000 * 1000;
+
+	// Bounded multi-producer queue: a producer claims a position with a CAS on enqueuePos and
+	// publishes the cell by bumping its sequence, the single writer thread consumes in order.
+	// Sequences are stored minus the cell index, so the all-zero state is a valid empty ring
+	// and nothing depends on initialization order.
+	struct Cell
+	{
+		LogRecord record;
+		uint64_t position;
+		std::atomic<uint64_t> sequence;
+	};
+
+	uint64_t Sequence(const Cell &cell, uint64_t pos)
+	{
+		return cell.sequence.load(std::memory_order_acquire) + (pos & (RING_SIZE - 1));
+	}
+
+	void SetSequence(Cell &cell, uint64_t pos, uint64_t sequence)
+	{
+		cell.sequence.store(sequence - (pos & (RING_SIZE - 1)), std::memory_order_release);
+	}
+
+	// Zero-initialized globals with nothing to destroy, so logging works regardless of static
+	// initialization order and the writer can still drain from the library destructor.
+	Cell cells[RING_SIZE];
+	std::atomic<uint64_t> enqueuePos;
+	uint64_t dequeuePos;
+	std::atomic<uint64_t> dropped;
+
+	pthread_t writerThread;
+	bool writerRunning;
+	std::atomic<bool> stopWriter;
+
+	uint64_t AsUnsigned(const LogArg &arg)
+	{
+		switch (arg.type)
+		{
+		case LogArg::Signed: return (uint64_t) arg.i;
+		case LogArg::Unsigned: return arg.u;
+		case LogArg::Double: return (uint64_t) arg.d;
+		case LogArg::Pointer: return (uint64_t) (uintptr_t) arg.p;
+		default: return 0;
+		}
+	}
+
+	double AsDouble(const LogArg &arg)
+	{
+		switch (arg.type)
+		{
+		case LogArg::Signed: return (double) arg.i;
+		case LogArg::Unsigned: return (double) arg.u;
+		case LogArg::Double: return arg.d;
+		default: return 0.0;
+		}
+	}
+
+	// printf for a captured record: each conversion is handed to snprintf with its single
+	// argument, with length modifiers normalized to the width the argument was stored with.
+	void FormatRecord(const LogRecord &record, std::string &out)
+	{
+		char buffer[256];
+		int nextArg = 0;
+
+		for (const char *c = record.format; *c; c++)
+		{
+			if (*c != '%')
+			{
+				out += *c;
+				continue;
+			}
+
+			if (c[1] == '%')
+			{
+				out += '%';
+				c++;
+				continue;
+			}
+
+			std::string spec = "%";
+			const char *s = c + 1;
+			while (*s && strchr("-+ #0123456789.", *s))
+				spec += *s++;
+			while (*s && strchr("hlLqjzt", *s))
+				s++;
+
+			char conversion = *s;
+			if (!conversion)
+				break;
+			c = s;
+
+			if (nextArg >= record.argCount)
+			{
+				out += spec + conversion;
+				continue;
+			}
+
+			const LogArg &arg = record.args[nextArg++];
+			switch (conversion)
+			{
+			case 'd': case 'i':
+				snprintf(buffer, sizeof(buffer), (spec + "lld").c_str(), (long long) AsUnsigned(arg));
+				break;
+			case 'u': case 'o': case 'x': case 'X':
+				snprintf(buffer, sizeof(buffer), (spec + "ll" + conversion).c_str(), (unsigned long long) AsUnsigned(arg));
+				break;
+			case 'c':
+				snprintf(buffer, sizeof(buffer), (spec + 'c').c_str(), (int) AsUnsigned(arg));
+				break;
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+				snprintf(buffer, sizeof(buffer), (spec + conversion).c_str(), AsDouble(arg));
+				break;
+			case 's':
+				snprintf(buffer, sizeof(buffer), (spec + 's').c_str(),
+					arg.type == LogArg::String ? record.strings + arg.stringOffset : "(?)");
+				break;
+			case 'p':
+				snprintf(buffer, sizeof(buffer), (spec + 'p').c_str(), (void *) (uintptr_t) AsUnsigned(arg));
+				break;
+			default:
+				snprintf(buffer, sizeof(buffer), "%%%c", conversion);
+				break;
+			}
+			out += buffer;
+		}
+	}
+
+	void WriteRecord(const LogRecord &record, std::string &out)
+	{
+		tm value;
+		localtime_r(&record.time.tv_sec, &value);
+
+		char prefix[32];
+		snprintf(prefix, sizeof(prefix), "[%02d:%02d:%02d] ", value.tm_hour, value.tm_min, value.tm_sec);
+		out += prefix;
+
+		if (record.suppressed)
+			out += "(" + std::to_string(record.suppressed) + " similar messages suppressed) ";
+
+		FormatRecord(record, out);
+		out += '\n';
+	}
+
+	// Formats everything queued so far with one write. Returns false if the ring was empty.
+	bool DrainRing()
+	{
+		std::string out;
+
+		for (;;)
+		{
+			Cell &cell = cells[dequeuePos & (RING_SIZE - 1)];
+			if (Sequence(cell, dequeuePos) != dequeuePos + 1)
+				break;
+
+			WriteRecord(cell.record, out);
+			SetSequence(cell, dequeuePos, dequeuePos + RING_SIZE);
+			dequeuePos++;
+		}
+
+		uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+		if (lost)
+			out += "(" + std::to_string(lost) + " log messages dropped, log queue full)\n";
+
+		if (out.empty())
+			return false;
+
+		fwrite(out.data(), 1, out.size(), LogFile);
+		fflush(LogFile);
+		return true;
+	}
+
+	void *RunWriter(void *)
+	{
+		while (!stopWriter.load(std::memory_order_relaxed))
+		{
+			if (!DrainRing())
+			{
+				timespec idle = { 0, IDLE_SLEEP_NS };
+				nanosleep(&idle, nullptr);
+			}
+		}
+		DrainRing();
+		return nullptr;
+	}
+}
+
 __attribute__((constructor)) void OpenLogFile()
 {
-	LogFile = fopen("space_calibrator_driver.log", "a");
+	LogFile = fopen(OPENVR_SPACECALIBRATOR_DRIVER_LOG_NAME, "a");
 	if (LogFile == nullptr)
 	{
 		LogFile = stderr;
 	}
+
+	writerRunning = pthread_create(&writerThread, nullptr, RunWriter, nullptr) == 0;
 }
 
-tm TimeForLog()
+__attribute__((destructor)) static void CloseLogFile()
 {
-	auto now = std::chrono::system_clock::now();
-	auto nowTime = std::chrono::system_clock::to_time_t(now);
-	tm value;
-	localtime_r(&nowTime, &value);
-	return value;
+	if (writerRunning)
+	{
+		stopWriter.store(true, std::memory_order_relaxed);
+		pthread_join(writerThread, nullptr);
+		writerRunning = false;
+	}
+	else
+	{
+		DrainRing();
+	}
 }
 
-void LogFlush()
+bool LogSite::Allow(const timespec &now, uint32_t &suppressedBefore)
 {
-	fflush(LogFile);
-}
\ No newline at end of file
+	int64_t second = now.tv_sec;
+	int64_t start = windowStart.load(std::memory_order_relaxed);
+	if (second != start && windowStart.compare_exchange_strong(start, second, std::memory_order_relaxed))
+		countInWindow.store(0, std::memory_order_relaxed);
+
+	if (countInWindow.fetch_add(1, std::memory_order_relaxed) >= MAX_PER_SECOND)
+	{
+		suppressed.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	suppressedBefore = suppressed.exchange(0, std::memory_order_relaxed);
+	return true;
+}
+
+LogRecord *LogBegin(LogSite &site, const char *format)
+{
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	uint32_t suppressed = 0;
+	if (!site.Allow(now, suppressed))
+		return nullptr;
+
+	uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		Cell &cell = cells[pos & (RING_SIZE - 1)];
+		int64_t diff = (int64_t) (Sequence(cell, pos) - pos);
+
+		if (diff == 0)
+		{
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				cell.position = pos;
+				cell.record.format = format;
+				cell.record.time = now;
+				cell.record.suppressed = suppressed;
+				cell.record.argCount = 0;
+				cell.record.stringBytes = 0;
+				return &cell.record;
+			}
+		}
+		else if (diff < 0)
+		{
+			// Full: never wait on the writer from a driver thread
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		else
+		{
+			pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void LogCommit(LogRecord *record)
+{
+	Cell *cell = reinterpret_cast<Cell *>(record);
+	SetSequence(*cell, cell->position, cell->position + 1);
+}
@@ -1,19 +1,139 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <type_traits>
+
+// The driver logs from SteamVR's pose and IPC threads, so LOG never formats or touches the
+// file. The call site copies the format string pointer, its arguments (strings by value) and a
+// timestamp into a lock-free ring, and a background thread formats and writes them in batches.
+// When the ring is full the message is dropped and counted instead of blocking.
 
 extern FILE *LogFile;
 
 void OpenLogFile();
-tm TimeForLog();
-void LogFlush();
+
+struct LogArg
+{
+	enum Type : uint8_t { Signed, Unsigned, Double, Pointer, String } type;
+	union {
+		int64_t i;
+		uint64_t u;
+		double d;
+		const void *p;
+		uint32_t stringOffset;
+	};
+};
+
+struct LogRecord
+{
+	static const int MAX_ARGS = 8;
+	static const int STRING_BYTES = 160;
+
+	const char *format;
+	timespec time;
+	uint32_t suppressed;
+	uint8_t argCount;
+	uint16_t stringBytes;
+	LogArg args[MAX_ARGS];
+	char strings[STRING_BYTES];
+
+	void Add(const char *str)
+	{
+		if (argCount >= MAX_ARGS)
+			return;
+
+		if (!str)
+			str = "(null)";
+
+		auto &arg = args[argCount++];
+		arg.type = LogArg::String;
+
+		// Out of room: point at the terminator of the previous string
+		if (stringBytes >= STRING_BYTES)
+		{
+			arg.stringOffset = STRING_BYTES - 1;
+			return;
+		}
+
+		// Strings are often temporaries (strerror, c_str), so they're copied, truncated if needed
+		size_t length = strnlen(str, STRING_BYTES - 1 - stringBytes);
+		arg.stringOffset = stringBytes;
+		memcpy(strings + stringBytes, str, length);
+		strings[stringBytes + length] = 0;
+		stringBytes += length + 1;
+	}
+
+	void Add(char *str)
+	{
+		Add((const char *) str);
+	}
+
+	template<typename T>
+	void Add(T value)
+	{
+		if (argCount >= MAX_ARGS)
+			return;
+
+		auto &arg = args[argCount++];
+		if constexpr (std::is_floating_point<T>::value)
+		{
+			arg.type = LogArg::Double;
+			arg.d = value;
+		}
+		else if constexpr (std::is_pointer<T>::value)
+		{
+			arg.type = LogArg::Pointer;
+			arg.p = (const void *) value;
+		}
+		else if constexpr (std::is_enum<T>::value || std::is_signed<T>::value)
+		{
+			arg.type = LogArg::Signed;
+			arg.i = (int64_t) value;
+		}
+		else
+		{
+			arg.type = LogArg::Unsigned;
+			arg.u = (uint64_t) value;
+		}
+	}
+};
+
+// Per call site state for rate limiting repeated messages, e.g. an accept() that keeps failing
+struct LogSite
+{
+	static const uint32_t MAX_PER_SECOND = 5;
+
+	std::atomic<int64_t> windowStart = { 0 };
+	std::atomic<uint32_t> countInWindow = { 0 };
+	std::atomic<uint32_t> suppressed = { 0 };
+
+	// Returns false if the message should be dropped; otherwise how many were dropped before it
+	bool Allow(const timespec &now, uint32_t &suppressedBefore);
+};
+
+LogRecord *LogBegin(LogSite &site, const char *format);
+void LogCommit(LogRecord *record);
+
+template<typename... Args>
+void LogWrite(LogSite &site, const char *format, Args... args)
+{
+	LogRecord *record = LogBegin(site, format);
+	if (!record)
+		return;
+
+	(record->Add(args), ...);
+	LogCommit(record);
+}
 
 #ifndef LOG
 #define LOG(fmt, ...) do { \
-	tm logNow = TimeForLog(); \
-	fprintf(LogFile, "[%02d:%02d:%02d] " fmt "\n", logNow.tm_hour, logNow.tm_min, logNow.tm_sec __VA_OPT__(,) __VA_ARGS__); \
-	LogFlush(); \
+	static LogSite logSite; \
+	if (false) fprintf(LogFile, fmt __VA_OPT__(,) __VA_ARGS__); /* format checking only */ \
+	LogWrite(logSite, fmt __VA_OPT__(,) __VA_ARGS__); \
 } while (0)
 #endif
 
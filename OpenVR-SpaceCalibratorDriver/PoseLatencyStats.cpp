@@ -0,0 +1,63 @@
+#include "PoseLatencyStats.h"
+
+double PoseLatencyStats::BucketValue(int bucket)
+{
+	if (bucket < SubBuckets)
+		return bucket;
+
+	int exponent = (bucket - SubBuckets) / SubBuckets + SubBits;
+	int sub = (bucket - SubBuckets) % SubBuckets;
+	double width = (double) (1ull << (exponent - SubBits));
+	return (double) (1ull << exponent) + (sub + 0.5) * width;
+}
+
+void PoseLatencyStats::Collect(protocol::DriverStats &stats)
+{
+	uint64_t now = Now();
+	stats.intervalSeconds = lastCollect ? (now - lastCollect) * 1e-9 : 0.0;
+	lastCollect = now;
+
+	for (uint32_t id = 0; id < vr::k_unMaxTrackedDeviceCount; id++)
+	{
+		auto &device = devices[id];
+		auto &last = lastBuckets[id];
+		auto &out = stats.devices[id];
+
+		uint64_t counts[BucketCount];
+		uint64_t total = 0;
+		for (int b = 0; b < BucketCount; b++)
+		{
+			uint64_t count = device.buckets[b].load(std::memory_order_relaxed);
+			counts[b] = count - last[b];
+			last[b] = count;
+			total += counts[b];
+		}
+
+		out.poses = total;
+		out.posesPerSecond = stats.intervalSeconds > 0.0 ? total / stats.intervalSeconds : 0.0;
+		out.maxNs = (double) device.max.exchange(0, std::memory_order_relaxed);
+		out.p50Ns = out.p99Ns = 0.0;
+		if (total == 0)
+			continue;
+
+		uint64_t p50Rank = (total + 1) / 2, p99Rank = total - total / 100, seen = 0;
+		for (int b = 0; b < BucketCount; b++)
+		{
+			if (counts[b] == 0)
+				continue;
+
+			seen += counts[b];
+			if (out.p50Ns == 0.0 && seen >= p50Rank)
+				out.p50Ns = BucketValue(b);
+			if (seen >= p99Rank)
+			{
+				out.p99Ns = BucketValue(b);
+				break;
+			}
+		}
+
+		// Bucket midpoints can overshoot the exact maximum
+		if (out.p50Ns > out.maxNs) out.p50Ns = out.maxNs;
+		if (out.p99Ns > out.maxNs) out.p99Ns = out.maxNs;
+	}
+}
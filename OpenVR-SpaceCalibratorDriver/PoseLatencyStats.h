@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../Protocol.h"
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+// Per-device histograms of how long the pose hook takes, written lock-free from the pose
+// threads and summarized on request from the IPC thread.
+//
+// Buckets are log-linear: exact below 2^SubBits ns, then 2^SubBits buckets per power of two,
+// so every bucket is within 1/8 of its value and the whole range up to ~1 minute fits in a
+// few hundred counters.
+class PoseLatencyStats
+{
+public:
+	static uint64_t Now()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+		return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+	}
+
+	void Record(uint32_t openVRID, uint64_t ns)
+	{
+		if (openVRID >= vr::k_unMaxTrackedDeviceCount)
+			return;
+
+		auto &device = devices[openVRID];
+		device.buckets[BucketFor(ns)].fetch_add(1, std::memory_order_relaxed);
+
+		uint64_t max = device.max.load(std::memory_order_relaxed);
+		while (ns > max && !device.max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) { }
+	}
+
+	// Fills stats with everything recorded since the previous call. Only called from one thread.
+	void Collect(protocol::DriverStats &stats);
+
+private:
+	static const int SubBits = 3;
+	static const int SubBuckets = 1 << SubBits;
+	static const int MaxExponent = 36;
+	static const int BucketCount = SubBuckets + (MaxExponent - SubBits) * SubBuckets;
+
+	static int BucketFor(uint64_t ns)
+	{
+		if (ns < SubBuckets)
+			return (int) ns;
+
+		int exponent = 63 - __builtin_clzll(ns);
+		if (exponent >= MaxExponent)
+			return BucketCount - 1;
+
+		int sub = (int) (ns >> (exponent - SubBits)) & (SubBuckets - 1);
+		return SubBuckets + (exponent - SubBits) * SubBuckets + sub;
+	}
+
+	// Midpoint of the values that land in bucket
+	static double BucketValue(int bucket);
+
+	struct Device
+	{
+		std::atomic<uint64_t> buckets[BucketCount] = {};
+		std::atomic<uint64_t> max = { 0 };
+	};
+
+	Device devices[vr::k_unMaxTrackedDeviceCount];
+
+	// Counts as of the previous Collect, to report per-interval numbers
+	uint64_t lastBuckets[vr::k_unMaxTrackedDeviceCount][BucketCount] = {};
+	uint64_t lastCollect = 0;
+};
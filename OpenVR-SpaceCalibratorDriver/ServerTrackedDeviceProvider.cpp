@@ -2,14 +2,25 @@
 #include "Logging.h"
 #include "InterfaceHookInjector.h"
 
-#include <cstring>
+#include <cmath>
 
 vr::EVRInitError ServerTrackedDeviceProvider::Init(vr::IVRDriverContext *pDriverContext)
 {
 	TRACE("ServerTrackedDeviceProvider::Init()");
 	VR_INIT_SERVER_DRIVER_CONTEXT(pDriverContext);
 
-	memset(transforms, 0, vr::k_unMaxTrackedDeviceCount * sizeof(DeviceTransform));
+	for (auto &tf : transforms)
+		tf = DeviceTransform();
+
+	// The transform table is how the overlay controls the pose hooks. If the named segment can't
+	// be created, keep a private one so transforms sent over IPC still apply.
+	if (!transformShmem.Create(OPENVR_SPACECALIBRATOR_TRANSFORM_SHMEM_NAME)) {
+		LOG("Warning: Failed to create transform shared memory, transforms only available over IPC");
+		if (!transformShmem.CreateAnonymous()) {
+			LOG("Failed to allocate transform table");
+			return vr::VRInitError_Init_Internal;
+		}
+	}
 
 	// Initialize shared memory for pose streaming
 	if (!poseShmem.Create(OPENVR_SPACECALIBRATOR_SHMEM_NAME)) {
@@ -32,6 +43,12 @@ void ServerTrackedDeviceProvider::Cleanup()
 	VR_CLEANUP_SERVER_DRIVER_CONTEXT();
 }
 
+void ServerTrackedDeviceProvider::RunFrame()
+{
+	// Pick up reader subscriptions and drop readers that stopped heartbeating
+	poseShmem.UpdateSubscriptions();
+}
+
 inline vr::HmdQuaternion_t operator*(const vr::HmdQuaternion_t &lhs, const vr::HmdQuaternion_t &rhs) {
 	return {
 		(lhs.w * rhs.w) - (lhs.x * rhs.x) - (lhs.y * rhs.y) - (lhs.z * rhs.z),
@@ -41,48 +58,247 @@ inline vr::HmdQuaternion_t operator*(const vr::HmdQuaternion_t &lhs, const vr::H
 	};
 }
 
-inline vr::HmdVector3d_t quaternionRotateVector(const vr::HmdQuaternion_t& quat, const double(&vector)[3]) {
-	vr::HmdQuaternion_t vectorQuat = { 0.0, vector[0], vector[1] , vector[2] };
-	vr::HmdQuaternion_t conjugate = { quat.w, -quat.x, -quat.y, -quat.z };
-	auto rotatedVectorQuat = quat * vectorQuat * conjugate;
-	return { rotatedVectorQuat.x, rotatedVectorQuat.y, rotatedVectorQuat.z };
+inline vr::HmdQuaternion_t quaternionSlerp(const vr::HmdQuaternion_t &from, vr::HmdQuaternion_t to, double t) {
+	double cosTheta = from.w * to.w + from.x * to.x + from.y * to.y + from.z * to.z;
+	if (cosTheta < 0.0)
+	{
+		// Take the short way around
+		to = { -to.w, -to.x, -to.y, -to.z };
+		cosTheta = -cosTheta;
+	}
+
+	double wFrom = 1.0 - t, wTo = t;
+	if (cosTheta < 0.9995)
+	{
+		double theta = acos(cosTheta);
+		double sinTheta = sin(theta);
+		wFrom = sin((1.0 - t) * theta) / sinTheta;
+		wTo = sin(t * theta) / sinTheta;
+	}
+
+	vr::HmdQuaternion_t result = {
+		wFrom * from.w + wTo * to.w,
+		wFrom * from.x + wTo * to.x,
+		wFrom * from.y + wTo * to.y,
+		wFrom * from.z + wTo * to.z
+	};
+
+	// Near-parallel inputs fall back to nlerp, which needs renormalizing
+	double norm = sqrt(result.w * result.w + result.x * result.x + result.y * result.y + result.z * result.z);
+	return { result.w / norm, result.x / norm, result.y / norm, result.z / norm };
 }
 
 void ServerTrackedDeviceProvider::SetDeviceTransform(const protocol::SetDeviceTransform &newTransform)
 {
-	auto &tf = transforms[newTransform.openVRID];
-	tf.enabled = newTransform.enabled;
+	if (newTransform.openVRID >= vr::k_unMaxTrackedDeviceCount)
+	{
+		LOG("Ignoring transform for invalid device %u", newTransform.openVRID);
+		return;
+	}
+
+	transformShmem.Publish([&](protocol::DeviceTransformTable &table) {
+		protocol::ApplyDeviceTransform(table.transforms[newTransform.openVRID], newTransform);
+	});
+}
+
+void ServerTrackedDeviceProvider::SetDeviceTransformBatch(const protocol::SetDeviceTransformBatch &batch)
+{
+	if (batch.count > vr::k_unMaxTrackedDeviceCount)
+	{
+		LOG("Ignoring transform batch with invalid count %u", batch.count);
+		return;
+	}
+
+	// One publish for the whole batch, so the pose hooks never see half of it applied
+	transformShmem.Publish([&](protocol::DeviceTransformTable &table) {
+		table.alignmentSpeedParams = batch.alignmentSpeedParams;
+
+		for (uint32_t i = 0; i < batch.count; i++)
+		{
+			const auto &tf = batch.transforms[i];
+			if (tf.openVRID >= vr::k_unMaxTrackedDeviceCount)
+			{
+				LOG("Ignoring transform for invalid device %u", tf.openVRID);
+				continue;
+			}
+			protocol::ApplyDeviceTransform(table.transforms[tf.openVRID], tf);
+		}
+	});
+}
+
+void ServerTrackedDeviceProvider::SetAlignmentSpeedParams(const protocol::AlignmentSpeedParams &params)
+{
+	transformShmem.Publish([&](protocol::DeviceTransformTable &table) {
+		table.alignmentSpeedParams = params;
+	});
+}
+
+void ServerTrackedDeviceProvider::GetDeviceTransforms(protocol::DeviceTransformTable &table) const
+{
+	transformShmem.ReadTable(table);
+}
+
+void ServerTrackedDeviceProvider::RefreshTransform(uint32_t openVRID, uint64_t version, DeviceTransform &tf)
+{
+	// On a torn read keep the previous transform and retry on the next pose
+	protocol::DeviceTransformState target;
+	protocol::AlignmentSpeedParams params;
+	if (!transformShmem.ReadTransform(version, openVRID, target) || !transformShmem.ReadAlignmentSpeedParams(version, params))
+		return;
+
+	tf.version = version;
+	tf.target = target;
+	tf.alignmentSpeedParams = params;
+
+	// Only blend between two enabled calibrations; anything else takes effect immediately.
+	if (!target.lerp || !target.enabled || !tf.enabled)
+	{
+		tf.enabled = target.enabled;
+		tf.translation = target.translation;
+		tf.rotation = target.rotation;
+		tf.scale = target.scale;
+		tf.speed = AlignmentSpeed::Tiny;
+		tf.blending = false;
+		BakeTransform(tf);
+	}
+	else if (!tf.blending)
+	{
+		tf.blending = true;
+		tf.lastBlend = std::chrono::steady_clock::now();
+	}
+
+	tf.passthrough = !tf.enabled && !target.quash;
+}
+
+void ServerTrackedDeviceProvider::BakeTransform(DeviceTransform &tf)
+{
+	const auto &q = tf.rotation;
+
+	double xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	double xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	double wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+	double columns[4][3] = {
+		{ 1.0 - 2.0 * (yy + zz), 2.0 * (xy + wz), 2.0 * (xz - wy) },
+		{ 2.0 * (xy - wz), 1.0 - 2.0 * (xx + zz), 2.0 * (yz + wx) },
+		{ 2.0 * (xz + wy), 2.0 * (yz - wx), 1.0 - 2.0 * (xx + yy) },
+		{ tf.translation.v[0], tf.translation.v[1], tf.translation.v[2] },
+	};
+
+	for (int c = 0; c < 4; c++)
+	{
+		for (int r = 0; r < 3; r++)
+			tf.matrix[c][r] = columns[c][r];
+		tf.matrix[c][3] = 0.0;
+	}
+}
+
+void ServerTrackedDeviceProvider::BlendTransform(DeviceTransform &tf)
+{
+	const auto &target = tf.target;
+	const auto &params = tf.alignmentSpeedParams;
 
-	if (newTransform.updateTranslation)
-		tf.translation = newTransform.translation;
+	auto now = std::chrono::steady_clock::now();
+	double deltaT = std::chrono::duration<double>(now - tf.lastBlend).count();
+	tf.lastBlend = now;
 
-	if (newTransform.updateRotation)
-		tf.rotation = newTransform.rotation;
+	double dx = target.translation.v[0] - tf.translation.v[0];
+	double dy = target.translation.v[1] - tf.translation.v[1];
+	double dz = target.translation.v[2] - tf.translation.v[2];
+	double transError = sqrt(dx * dx + dy * dy + dz * dz);
 
-	if (newTransform.updateScale)
-		tf.scale = newTransform.scale;
+	double dot = fabs(target.rotation.w * tf.rotation.w + target.rotation.x * tf.rotation.x
+		+ target.rotation.y * tf.rotation.y + target.rotation.z * tf.rotation.z);
+	double rotError = 2.0 * acos(dot < 1.0 ? dot : 1.0);
+
+	// Speed up as soon as the error grows past small/large, but only slow down again once it
+	// has settled under tiny, so a correction finishes at the speed it started with.
+	if (transError > params.thr_trans_large || rotError > params.thr_rot_large)
+		tf.speed = AlignmentSpeed::Large;
+	else if ((transError > params.thr_trans_small || rotError > params.thr_rot_small) && tf.speed == AlignmentSpeed::Tiny)
+		tf.speed = AlignmentSpeed::Small;
+	else if (transError < params.thr_trans_tiny && rotError < params.thr_rot_tiny)
+		tf.speed = AlignmentSpeed::Tiny;
+
+	double speed = params.align_speed_tiny;
+	if (tf.speed == AlignmentSpeed::Small)
+		speed = params.align_speed_small;
+	else if (tf.speed == AlignmentSpeed::Large)
+		speed = params.align_speed_large;
+
+	double t = speed * deltaT;
+	bool arrived = transError < 1e-6 && rotError < 1e-6 && fabs(target.scale - tf.scale) < 1e-9;
+	if (t >= 1.0 || !(t > 0.0) || arrived)
+	{
+		// Close enough to snap; stop blending until the next lerp target
+		tf.translation = target.translation;
+		tf.rotation = target.rotation;
+		tf.scale = target.scale;
+		tf.blending = false;
+		BakeTransform(tf);
+		return;
+	}
+
+	tf.translation.v[0] += dx * t;
+	tf.translation.v[1] += dy * t;
+	tf.translation.v[2] += dz * t;
+	tf.rotation = quaternionSlerp(tf.rotation, target.rotation, t);
+	tf.scale += (target.scale - tf.scale) * t;
+	BakeTransform(tf);
 }
 
 bool ServerTrackedDeviceProvider::HandleDevicePoseUpdated(uint32_t openVRID, vr::DriverPose_t &pose)
 {
 	// Write the ORIGINAL pose to shared memory BEFORE applying transforms
 	// This is critical - we want the raw driver pose for calibration!
+	// Skipped entirely unless a live reader subscribed to this device.
 	poseShmem.WritePose(openVRID, pose);
 
+	if (openVRID >= vr::k_unMaxTrackedDeviceCount)
+		return true;
+
 	auto &tf = transforms[openVRID];
-	if (tf.enabled)
-	{
-		pose.qWorldFromDriverRotation = tf.rotation * pose.qWorldFromDriverRotation;
 
-		pose.vecPosition[0] *= tf.scale;
-		pose.vecPosition[1] *= tf.scale;
-		pose.vecPosition[2] *= tf.scale;
+	// A single acquire load per pose; the entry is only copied when the overlay published a
+	// new table.
+	uint64_t version = transformShmem.Version();
+	if (version != tf.version)
+		RefreshTransform(openVRID, version, tf);
+
+	if (tf.passthrough)
+		return true;
 
-		vr::HmdVector3d_t rotatedTranslation = quaternionRotateVector(tf.rotation, pose.vecWorldFromDriverTranslation);
-		pose.vecWorldFromDriverTranslation[0] = rotatedTranslation.v[0] + tf.translation.v[0];
-		pose.vecWorldFromDriverTranslation[1] = rotatedTranslation.v[1] + tf.translation.v[1];
-		pose.vecWorldFromDriverTranslation[2] = rotatedTranslation.v[2] + tf.translation.v[2];
+	// Quashed devices are only tracked for calibration: SteamVR gets none or every Nth update.
+	if (tf.target.quash)
+	{
+		uint32_t interval = tf.target.quashForwardInterval;
+		if (interval == 0 || ++tf.quashedUpdates < interval)
+			return false;
+		tf.quashedUpdates = 0;
 	}
+
+	if (!tf.enabled)
+		return true;
+
+	// Blend per pose, so corrections move at the device's own update rate
+	if (tf.blending)
+		BlendTransform(tf);
+
+	pose.qWorldFromDriverRotation = tf.rotation * pose.qWorldFromDriverRotation;
+
+	pose.vecPosition[0] *= tf.scale;
+	pose.vecPosition[1] *= tf.scale;
+	pose.vecPosition[2] *= tf.scale;
+
+	// vecWorldFromDriverTranslation = R * v + T, as one fixed-size mat-vec
+	const double *v = pose.vecWorldFromDriverTranslation;
+	const auto &m = tf.matrix;
+	double result[4];
+	for (int i = 0; i < 4; i++)
+		result[i] = m[0][i] * v[0] + m[1][i] * v[1] + m[2][i] * v[2] + m[3][i];
+
+	pose.vecWorldFromDriverTranslation[0] = result[0];
+	pose.vecWorldFromDriverTranslation[1] = result[1];
+	pose.vecWorldFromDriverTranslation[2] = result[2];
 	return true;
 }
-
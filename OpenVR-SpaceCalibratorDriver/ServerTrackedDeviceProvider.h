@@ -1,10 +1,13 @@
 #pragma once
 
 #include "IPCServer.h"
+#include "PoseLatencyStats.h"
 #include "../Protocol.h"
 
 #include <openvr_driver.h>
 
+#include <chrono>
+
 class ServerTrackedDeviceProvider : public vr::IServerTrackedDeviceProvider
 {
 public:
@@ -20,7 +23,7 @@ public:
 	virtual const char * const *GetInterfaceVersions() { return vr::k_InterfaceVersions; }
 
 	/** Allows the driver do to some work in the main loop of the server. */
-	virtual void RunFrame() { }
+	virtual void RunFrame();
 
 	/** Returns true if the driver wants to block Standby mode. */
 	virtual bool ShouldBlockStandbyMode() { return false; }
@@ -37,19 +40,54 @@ public:
 
 	ServerTrackedDeviceProvider() : server(this) { }
 	void SetDeviceTransform(const protocol::SetDeviceTransform &newTransform);
+	void SetDeviceTransformBatch(const protocol::SetDeviceTransformBatch &batch);
+	void SetAlignmentSpeedParams(const protocol::AlignmentSpeedParams &params);
+	void GetDeviceTransforms(protocol::DeviceTransformTable &table) const;
 	bool HandleDevicePoseUpdated(uint32_t openVRID, vr::DriverPose_t &pose);
+	void RecordPoseLatency(uint32_t openVRID, uint64_t ns) { poseStats.Record(openVRID, ns); }
+	void GetDriverStats(protocol::DriverStats &stats) { poseStats.Collect(stats); }
 
 private:
+	// Drives the pose hook on a private transform table, without Init; see bench/PoseHookBench.cpp
+	friend struct PoseHookBench;
+
 	IPCServer server;
 	protocol::DriverPoseShmem poseShmem;
+	protocol::DeviceTransformShmem transformShmem;
+	PoseLatencyStats poseStats;
 
+	enum class AlignmentSpeed { Tiny, Small, Large };
+
+	// Per-device state owned by the thread delivering that device's poses. target is a copy of
+	// the device's entry in transformShmem, refreshed only when the table's version moves; the
+	// applied translation/rotation/scale blend toward it when lerp is set.
 	struct DeviceTransform
 	{
+		// The applied transform baked for the pose hook: rotation matrix columns 0-2 and the
+		// translation in column 3, padded to four lanes so the mat-vec vectorizes.
+		alignas(32) double matrix[4][4] = {};
+
+		// Nothing to apply or quash, the pose goes through untouched
+		bool passthrough = true;
+		bool blending = false;
+
+		uint64_t version = UINT64_MAX;
+		protocol::DeviceTransformState target = {};
+		protocol::AlignmentSpeedParams alignmentSpeedParams = {};
+
 		bool enabled = false;
-		vr::HmdVector3d_t translation;
-		vr::HmdQuaternion_t rotation;
-		double scale;
+		vr::HmdVector3d_t translation = {};
+		vr::HmdQuaternion_t rotation = { 1.0, 0.0, 0.0, 0.0 };
+		double scale = 1.0;
+
+		AlignmentSpeed speed = AlignmentSpeed::Tiny;
+		uint32_t quashedUpdates = 0;
+		std::chrono::steady_clock::time_point lastBlend;
 	};
 
+	void RefreshTransform(uint32_t openVRID, uint64_t version, DeviceTransform &tf);
+	static void BlendTransform(DeviceTransform &tf);
+	static void BakeTransform(DeviceTransform &tf);
+
 	DeviceTransform transforms[vr::k_unMaxTrackedDeviceCount];
 };
\ No newline at end of file
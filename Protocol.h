@@ -4,6 +4,8 @@
 #include <atomic>
 #include <functional>
 #include <cstring>
+#include <cstddef>
+#include <cstdio>
 
 // Linux-specific includes for shared memory
 #include <sys/mman.h>
@@ -11,6 +13,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <climits>
+#include <sched.h>
+#include <pthread.h>
+#include <cerrno>
 #include <time.h>
 
 #ifndef _OPENVR_API
@@ -19,6 +27,7 @@
 
 #define OPENVR_SPACECALIBRATOR_PIPE_NAME "/tmp/OpenVRSpaceCalibratorDriver.sock"
 #define OPENVR_SPACECALIBRATOR_SHMEM_NAME "/OpenVRSpaceCalibratorPoseMemory"
+#define OPENVR_SPACECALIBRATOR_TRANSFORM_SHMEM_NAME "/OpenVRSpaceCalibratorTransforms"
 
 // When included in overlay (not driver), define DriverPose_t ourselves
 #ifdef _OPENVR_API
@@ -47,7 +56,7 @@ namespace vr {
 
 namespace protocol
 {
-	const uint32_t Version = 4;
+	const uint32_t Version = 14;
 
 	enum RequestType
 	{
@@ -55,7 +64,10 @@ namespace protocol
 		RequestHandshake,
 		RequestSetDeviceTransform,
 		RequestSetAlignmentSpeedParams,
-		RequestDebugOffset
+		RequestDebugOffset,
+		RequestSetDeviceTransformBatch,
+		RequestGetDeviceTransforms,
+		RequestGetDriverStats
 	};
 
 	enum ResponseType
@@ -63,6 +75,8 @@ namespace protocol
 		ResponseInvalid,
 		ResponseHandshake,
 		ResponseSuccess,
+		ResponseDeviceTransforms,
+		ResponseDriverStats,
 	};
 
 	struct Protocol
@@ -77,7 +91,7 @@ namespace protocol
 		 * between current and target calibrations. Generally, we increase the speed if we go
 		 * above small/large, and decrease it only once it's under tiny.
 		 *
-		 * These values are expressed as distance squared
+		 * These values are expressed in meters
 		 */
 		double thr_trans_tiny, thr_trans_small, thr_trans_large;
 
@@ -104,34 +118,118 @@ namespace protocol
 		vr::HmdQuaternion_t rotation;
 		double scale;
 		bool lerp;
+
+		/**
+		 * Keep the device's poses from SteamVR (they still reach shared memory), forwarding only
+		 * every quashForwardInterval-th update, or none if it is 0.
+		 */
 		bool quash;
+		uint32_t quashForwardInterval;
 
 		SetDeviceTransform(uint32_t id, bool enabled) :
-			openVRID(id), enabled(enabled), updateTranslation(false), updateRotation(false), updateScale(false), translation({}), rotation({1,0,0,0}), scale(1), lerp(false), quash(false) { }
+			openVRID(id), enabled(enabled), updateTranslation(false), updateRotation(false), updateScale(false), translation({}), rotation({1,0,0,0}), scale(1), lerp(false), quash(false), quashForwardInterval(0) { }
 
 		SetDeviceTransform(uint32_t id, bool enabled, vr::HmdVector3d_t translation) :
-			openVRID(id), enabled(enabled), updateTranslation(true), updateRotation(false), updateScale(false), translation(translation), rotation({1,0,0,0}), scale(1), lerp(false), quash(false) { }
+			openVRID(id), enabled(enabled), updateTranslation(true), updateRotation(false), updateScale(false), translation(translation), rotation({1,0,0,0}), scale(1), lerp(false), quash(false), quashForwardInterval(0) { }
 
 		SetDeviceTransform(uint32_t id, bool enabled, vr::HmdQuaternion_t rotation) :
-			openVRID(id), enabled(enabled), updateTranslation(false), updateRotation(true), updateScale(false), translation({}), rotation(rotation), scale(1), lerp(false), quash(false) { }
+			openVRID(id), enabled(enabled), updateTranslation(false), updateRotation(true), updateScale(false), translation({}), rotation(rotation), scale(1), lerp(false), quash(false), quashForwardInterval(0) { }
 
 		SetDeviceTransform(uint32_t id, bool enabled, double scale) :
-			openVRID(id), enabled(enabled), updateTranslation(false), updateRotation(false), updateScale(true), translation({}), rotation({1,0,0,0}), scale(scale), lerp(false), quash(false) { }
+			openVRID(id), enabled(enabled), updateTranslation(false), updateRotation(false), updateScale(true), translation({}), rotation({1,0,0,0}), scale(scale), lerp(false), quash(false), quashForwardInterval(0) { }
 
 		SetDeviceTransform(uint32_t id, bool enabled, vr::HmdVector3d_t translation, vr::HmdQuaternion_t rotation) :
-			openVRID(id), enabled(enabled), updateTranslation(true), updateRotation(true), updateScale(false), translation(translation), rotation(rotation), scale(1), lerp(false), quash(false) { }
+			openVRID(id), enabled(enabled), updateTranslation(true), updateRotation(true), updateScale(false), translation(translation), rotation(rotation), scale(1), lerp(false), quash(false), quashForwardInterval(0) { }
 
 		SetDeviceTransform(uint32_t id, bool enabled, vr::HmdVector3d_t translation, vr::HmdQuaternion_t rotation, double scale) :
-			openVRID(id), enabled(enabled), updateTranslation(true), updateRotation(true), updateScale(true), translation(translation), rotation(rotation), scale(scale), lerp(false), quash(false) { }
+			openVRID(id), enabled(enabled), updateTranslation(true), updateRotation(true), updateScale(true), translation(translation), rotation(rotation), scale(scale), lerp(false), quash(false), quashForwardInterval(0) { }
+	};
+
+	/**
+	 * Alignment parameters plus the transforms of every device, sent as one message so the
+	 * driver applies a whole calibration at once instead of device by device.
+	 */
+	struct SetDeviceTransformBatch
+	{
+		AlignmentSpeedParams alignmentSpeedParams;
+		uint32_t count;
+		SetDeviceTransform transforms[vr::k_unMaxTrackedDeviceCount];
+	};
+
+	/**
+	 * The transform the driver currently applies to a device.
+	 */
+	struct DeviceTransformState
+	{
+		bool enabled;
+		vr::HmdVector3d_t translation;
+		vr::HmdQuaternion_t rotation;
+		double scale;
+		bool lerp;
+		bool quash;
+		uint32_t quashForwardInterval;
+	};
+
+	/**
+	 * Merges an update into a device's transform, honoring its update* flags.
+	 */
+	inline void ApplyDeviceTransform(DeviceTransformState &state, const SetDeviceTransform &update)
+	{
+		state.enabled = update.enabled;
+
+		if (update.updateTranslation)
+			state.translation = update.translation;
+
+		if (update.updateRotation)
+			state.rotation = update.rotation;
+
+		if (update.updateScale)
+			state.scale = update.scale;
+
+		state.lerp = update.lerp;
+		state.quash = update.quash;
+		state.quashForwardInterval = update.quashForwardInterval;
+	}
+
+	/**
+	 * Snapshot of the driver's transform table, used by the overlay to resync after connecting.
+	 */
+	struct DeviceTransformTable
+	{
+		AlignmentSpeedParams alignmentSpeedParams;
+		DeviceTransformState transforms[vr::k_unMaxTrackedDeviceCount];
+	};
+
+	/**
+	 * Time spent in the pose hook for one device, over the interval since the previous
+	 * RequestGetDriverStats. Covers the shared memory write, the transform and the call into
+	 * SteamVR.
+	 */
+	struct DevicePoseStats
+	{
+		uint64_t poses;
+		double posesPerSecond;
+		double p50Ns, p99Ns, maxNs;
+	};
+
+	struct DriverStats
+	{
+		double intervalSeconds;
+		DevicePoseStats devices[vr::k_unMaxTrackedDeviceCount];
 	};
 
 	struct Request
 	{
 		RequestType type;
 
+		// Chosen by the client and echoed in the matching Response, so several requests can be
+		// in flight on one connection
+		uint32_t requestId = 0;
+
 		union {
 			SetDeviceTransform setDeviceTransform;
 			AlignmentSpeedParams setAlignmentSpeedParams;
+			SetDeviceTransformBatch setDeviceTransformBatch;
 		};
 
 		Request() : type(RequestInvalid), setAlignmentSpeedParams({}) { }
@@ -142,15 +240,104 @@ namespace protocol
 	struct Response
 	{
 		ResponseType type;
+		uint32_t requestId = 0;
 
 		union {
 			Protocol protocol;
+			DeviceTransformTable deviceTransforms;
+			DriverStats driverStats;
 		};
 
 		Response() : type(ResponseInvalid) { }
 		Response(ResponseType type) : type(type) { }
 	};
 
+	/**
+	 * Every message on the socket is a MessageHeader followed by length bytes of payload, padded
+	 * with zeros to a multiple of 8 so the next header (and any payload read in place) stays
+	 * aligned. Payloads only carry what the message uses, e.g. a batch only its count entries.
+	 */
+	struct MessageHeader
+	{
+		uint32_t length;
+		uint16_t type;
+		uint16_t version;
+		uint32_t requestId;
+		uint32_t reserved;
+	};
+
+	static_assert(sizeof(MessageHeader) == 16, "MessageHeader is part of the wire format");
+
+	const uint32_t MaxPayloadSize = 64 * 1024;
+
+	inline size_t PaddedPayloadSize(size_t length)
+	{
+		return (length + 7) & ~(size_t) 7;
+	}
+
+	inline size_t BatchPayloadSize(uint32_t count)
+	{
+		return offsetof(SetDeviceTransformBatch, transforms) + count * sizeof(SetDeviceTransform);
+	}
+
+	/**
+	 * The part of request that goes on the wire after its header.
+	 */
+	inline size_t RequestPayload(const Request &request, const void *&payload)
+	{
+		switch (request.type)
+		{
+		case RequestSetDeviceTransform:
+			payload = &request.setDeviceTransform;
+			return sizeof(request.setDeviceTransform);
+		case RequestSetAlignmentSpeedParams:
+			payload = &request.setAlignmentSpeedParams;
+			return sizeof(request.setAlignmentSpeedParams);
+		case RequestSetDeviceTransformBatch:
+			payload = &request.setDeviceTransformBatch;
+			return BatchPayloadSize(request.setDeviceTransformBatch.count);
+		default:
+			payload = nullptr;
+			return 0;
+		}
+	}
+
+	inline size_t ResponsePayload(const Response &response, const void *&payload)
+	{
+		switch (response.type)
+		{
+		case ResponseHandshake:
+			payload = &response.protocol;
+			return sizeof(response.protocol);
+		case ResponseDeviceTransforms:
+			payload = &response.deviceTransforms;
+			return sizeof(response.deviceTransforms);
+		case ResponseDriverStats:
+			payload = &response.driverStats;
+			return sizeof(response.driverStats);
+		default:
+			payload = nullptr;
+			return 0;
+		}
+	}
+
+	/**
+	 * Fills response from a received frame. Returns false if the payload can't be one.
+	 */
+	inline bool DecodeResponse(const MessageHeader &header, const char *payload, Response &response)
+	{
+		response.type = (ResponseType) header.type;
+		response.requestId = header.requestId;
+
+		const void *expected;
+		size_t expectedSize = ResponsePayload(response, expected);
+		if (header.length != expectedSize)
+			return false;
+
+		memcpy((void *) expected, payload, expectedSize);
+		return true;
+	}
+
 	// Shared memory for real-time pose streaming from driver to overlay
 	class DriverPoseShmem {
 	public:
@@ -160,20 +347,99 @@ namespace protocol
 			vr::DriverPose_t pose;
 		};
 
+		static const uint32_t MAX_READERS = 8;
+
+		/**
+		 * A reader that hasn't refreshed its heartbeat for this long is treated as gone, and the
+		 * driver stops writing the devices it subscribed to.
+		 */
+		static const uint64_t READER_TIMEOUT_NS = 3000000000ull;
+
 	private:
 		static const uint32_t BUFFERED_SAMPLES = 64 * 1024;
 
+		struct ReaderSlot {
+			std::atomic<uint64_t> owner;
+			std::atomic<uint64_t> heartbeat;  // CLOCK_MONOTONIC, in nanoseconds
+			std::atomic<uint64_t> subscribeMask;
+			std::atomic<uint64_t> wakeMask;
+		};
+
 		struct ShmemData {
 			std::atomic<uint64_t> index;
+
+			// Futex word bumped by the driver after writing a pose for a device in a wake mask.
+			// Readers block on it instead of polling; waiters lets the driver skip the wake
+			// syscall when nobody is sleeping.
+			std::atomic<uint32_t> wakeSeq;
+			std::atomic<uint32_t> waiters;
+
+			ReaderSlot readers[MAX_READERS];
+
 			AugmentedPose poses[BUFFERED_SAMPLES];
 		};
 
+		static long Futex(std::atomic<uint32_t> *word, int op, uint32_t val, const timespec *timeout) {
+			return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), op, val, timeout, nullptr, 0);
+		}
+
+		static uint64_t MonotonicNs() {
+			timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+		}
+
 	private:
 		int fd;
 		ShmemData* pData;
 		uint64_t cursor;
+		uint32_t lastWakeSeq;
 		AugmentedPose lastPose[vr::k_unMaxTrackedDeviceCount];
 
+		// Reader side: the slot we own and the masks to restore if it has to be reclaimed
+		int readerSlot;
+		uint64_t readerToken;
+		uint64_t subscribeMask, wakeMask;
+
+		// Writer side: union of the masks of live readers, refreshed by UpdateSubscriptions
+		std::atomic<uint64_t> activeMask, activeWakeMask;
+
+		bool ClaimReaderSlot() {
+			static std::atomic<uint32_t> tokenCounter(0);
+			readerToken = ((uint64_t) getpid() << 32) | ++tokenCounter;
+
+			uint64_t now = MonotonicNs();
+			for (uint32_t i = 0; i < MAX_READERS; i++) {
+				auto &slot = pData->readers[i];
+				uint64_t heartbeat = slot.heartbeat.load();
+				if (heartbeat != 0 && (int64_t) (now - heartbeat) < (int64_t) READER_TIMEOUT_NS) {
+					continue;
+				}
+				if (!slot.heartbeat.compare_exchange_strong(heartbeat, now)) {
+					continue;
+				}
+				slot.owner = readerToken;
+				slot.subscribeMask = subscribeMask;
+				slot.wakeMask = wakeMask;
+				readerSlot = (int) i;
+				return true;
+			}
+			readerSlot = -1;
+			return false;
+		}
+
+		void ReleaseReaderSlot() {
+			if (readerSlot < 0) return;
+			auto &slot = pData->readers[readerSlot];
+			if (slot.owner.load() == readerToken) {
+				slot.subscribeMask = 0;
+				slot.wakeMask = 0;
+				slot.heartbeat = 0;
+				slot.owner = 0;
+			}
+			readerSlot = -1;
+		}
+
 	public:
 		operator bool() const {
 			return pData != nullptr;
@@ -187,7 +453,12 @@ namespace protocol
 			fd = -1;
 			pData = nullptr;
 			cursor = 0;
+			lastWakeSeq = 0;
 			memset(lastPose, 0, sizeof(lastPose));
+			readerSlot = -1;
+			readerToken = 0;
+			subscribeMask = wakeMask = 0;
+			activeMask = activeWakeMask = 0;
 		}
 
 		~DriverPoseShmem() {
@@ -196,6 +467,7 @@ namespace protocol
 
 		void Close() {
 			if (pData) {
+				ReleaseReaderSlot();
 				munmap(pData, sizeof(ShmemData));
 				pData = nullptr;
 			}
@@ -240,6 +512,15 @@ namespace protocol
 
 			// Initialize
 			pData->index = 0;
+			pData->wakeSeq = 0;
+			pData->waiters = 0;
+			for (auto &slot : pData->readers) {
+				slot.owner = 0;
+				slot.heartbeat = 0;
+				slot.subscribeMask = 0;
+				slot.wakeMask = 0;
+			}
+			activeMask = activeWakeMask = 0;
 
 			return true;
 		}
@@ -271,12 +552,20 @@ namespace protocol
 			}
 
 			cursor = pData->index;
+			lastWakeSeq = pData->wakeSeq;
+			if (!ClaimReaderSlot()) {
+				// Still usable, but the driver will only write poses subscribed by other readers
+				fprintf(stderr, "No free reader slot in pose shared memory\n");
+			}
 			return true;
 		}
 
 		void WritePose(int deviceId, const vr::DriverPose_t& pose) {
 			if (!pData) return;
 
+			uint64_t deviceBit = 1ull << deviceId;
+			if (!(activeMask.load(std::memory_order_relaxed) & deviceBit)) return;
+
 			uint64_t writeIndex = pData->index.fetch_add(1);
 			uint64_t slot = writeIndex % BUFFERED_SAMPLES;
 
@@ -284,6 +573,103 @@ namespace protocol
 			clock_gettime(CLOCK_MONOTONIC, &aug.sample_time);
 			aug.deviceId = deviceId;
 			aug.pose = pose;
+
+			if (activeWakeMask.load(std::memory_order_relaxed) & deviceBit) {
+				pData->wakeSeq.fetch_add(1, std::memory_order_release);
+				if (pData->waiters.load(std::memory_order_relaxed) != 0) {
+					Futex(&pData->wakeSeq, FUTEX_WAKE, INT_MAX, nullptr);
+				}
+			}
+		}
+
+		/**
+		 * Driver side: recomputes which devices any live reader wants. Called once per server
+		 * frame so the pose path only tests a cached mask.
+		 */
+		void UpdateSubscriptions() {
+			if (!pData) return;
+
+			uint64_t now = MonotonicNs();
+			uint64_t mask = 0, wake = 0;
+			for (auto &slot : pData->readers) {
+				if (slot.owner.load(std::memory_order_relaxed) == 0) continue;
+				if ((int64_t) (now - slot.heartbeat.load(std::memory_order_relaxed)) >= (int64_t) READER_TIMEOUT_NS) continue;
+				mask |= slot.subscribeMask.load(std::memory_order_relaxed);
+				wake |= slot.wakeMask.load(std::memory_order_relaxed);
+			}
+			activeMask.store(mask | wake, std::memory_order_relaxed);
+			activeWakeMask.store(wake, std::memory_order_relaxed);
+		}
+
+		/**
+		 * Reader side: keeps this reader's subscriptions alive. Must be called more often than
+		 * READER_TIMEOUT_NS; reclaims a slot if ours was taken over after going stale.
+		 */
+		void Heartbeat() {
+			if (!pData) return;
+
+			if (readerSlot >= 0 && pData->readers[readerSlot].owner.load() == readerToken) {
+				pData->readers[readerSlot].heartbeat.store(MonotonicNs(), std::memory_order_relaxed);
+			} else {
+				ClaimReaderSlot();
+			}
+		}
+
+		/**
+		 * Selects which devices the driver writes for this reader. Bit N corresponds to openVRID N.
+		 */
+		void Subscribe(uint64_t mask) {
+			subscribeMask = mask;
+			if (!pData || readerSlot < 0) return;
+			pData->readers[readerSlot].subscribeMask.store(mask, std::memory_order_relaxed);
+		}
+
+		/**
+		 * Selects which devices wake readers blocked in WaitForPoses. Devices in the wake mask are
+		 * implicitly subscribed; a zero mask means the driver never signals for this reader.
+		 */
+		void SetWakeMask(uint64_t mask) {
+			wakeMask = mask;
+			if (!pData || readerSlot < 0) return;
+			pData->readers[readerSlot].wakeMask.store(mask, std::memory_order_relaxed);
+		}
+
+		/**
+		 * Blocks until a pose for a device in the wake mask is written, Wake() is called or the
+		 * timeout expires. Returns true if the driver signalled since the last call.
+		 */
+		bool WaitForPoses(int timeoutMs) {
+			if (!pData) return false;
+
+			uint32_t seq = pData->wakeSeq.load(std::memory_order_acquire);
+			if (seq == lastWakeSeq) {
+				timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+				pData->waiters.fetch_add(1);
+				Futex(&pData->wakeSeq, FUTEX_WAIT, seq, &timeout);
+				pData->waiters.fetch_sub(1);
+				seq = pData->wakeSeq.load(std::memory_order_acquire);
+			}
+
+			bool signalled = seq != lastWakeSeq;
+			lastWakeSeq = seq;
+			return signalled;
+		}
+
+		/**
+		 * Wakes every reader blocked in WaitForPoses, e.g. to let a sampler thread shut down.
+		 */
+		void Wake() {
+			if (!pData) return;
+			pData->wakeSeq.fetch_add(1, std::memory_order_release);
+			Futex(&pData->wakeSeq, FUTEX_WAKE, INT_MAX, nullptr);
+		}
+
+		/**
+		 * Drops any unread history so the next ReadNewPoses only returns poses written from now on.
+		 */
+		void SkipToLatest() {
+			if (!pData) return;
+			cursor = pData->index.load();
 		}
 
 		template<typename F>
@@ -317,4 +703,234 @@ namespace protocol
 			}
 		}
 	};
+
+	// Shared memory transform table, published by the overlay (or the driver's IPC thread) and
+	// read lock-free by the driver's pose hooks.
+	//
+	// The table is double buffered: a writer fills the buffer not referenced by version and then
+	// bumps version, so readers see a new table with a single acquire load. Each buffer also
+	// carries a sequence number (odd while being written) so a reader that races two publishes
+	// in a row can detect a torn copy and retry on its next pose.
+	class DeviceTransformShmem {
+	private:
+		struct Buffer {
+			std::atomic<uint32_t> seq;
+			DeviceTransformTable table;
+		};
+
+		struct ShmemData {
+			std::atomic<uint64_t> version;
+
+			// Both the overlay and the driver's IPC thread publish. Robust, so a writer that dies
+			// holding it hands it to the next one instead of locking everyone out.
+			pthread_mutex_t writerLock;
+
+			Buffer buffers[2];
+		};
+
+		int fd;
+		ShmemData* pData;
+
+		bool Map(int extraMmapFlags) {
+			pData = reinterpret_cast<ShmemData*>(mmap(
+				nullptr,
+				sizeof(ShmemData),
+				PROT_READ | PROT_WRITE,
+				MAP_SHARED | extraMmapFlags,
+				fd,
+				0
+			));
+
+			if (pData == MAP_FAILED) {
+				if (fd >= 0) close(fd);
+				fd = -1;
+				pData = nullptr;
+				return false;
+			}
+			return true;
+		}
+
+		void Initialize() {
+			memset((void *) pData, 0, sizeof(ShmemData));
+			for (auto &buffer : pData->buffers) {
+				for (auto &tf : buffer.table.transforms) {
+					tf.rotation.w = 1.0;
+					tf.scale = 1.0;
+				}
+			}
+
+			pthread_mutexattr_t attr;
+			pthread_mutexattr_init(&attr);
+			pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+			pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+			pthread_mutex_init(&pData->writerLock, &attr);
+			pthread_mutexattr_destroy(&attr);
+		}
+
+		bool LockWriter() {
+			int result = pthread_mutex_lock(&pData->writerLock);
+			if (result == EOWNERDEAD) {
+				// The previous writer died mid-publish. It only wrote the unpublished buffer, which
+				// the next publish fills from scratch, but its sequence number may have been left
+				// odd; make it even again so readers' torn-copy checks keep working.
+				for (auto &buffer : pData->buffers) {
+					if (buffer.seq.load(std::memory_order_relaxed) & 1)
+						buffer.seq.fetch_add(1, std::memory_order_relaxed);
+				}
+				pthread_mutex_consistent(&pData->writerLock);
+				return true;
+			}
+			return result == 0;
+		}
+
+		void UnlockWriter() {
+			pthread_mutex_unlock(&pData->writerLock);
+		}
+
+	public:
+		operator bool() const {
+			return pData != nullptr;
+		}
+
+		DeviceTransformShmem() : fd(-1), pData(nullptr) { }
+
+		~DeviceTransformShmem() {
+			Close();
+		}
+
+		void Close() {
+			if (pData) {
+				munmap(pData, sizeof(ShmemData));
+				pData = nullptr;
+			}
+			if (fd >= 0) {
+				close(fd);
+				fd = -1;
+			}
+		}
+
+		bool Create(const char* segment_name) {
+			Close();
+
+			fd = shm_open(segment_name, O_CREAT | O_RDWR, 0666);
+			if (fd < 0) {
+				return false;
+			}
+
+			if (ftruncate(fd, sizeof(ShmemData)) < 0) {
+				close(fd);
+				fd = -1;
+				return false;
+			}
+
+			if (!Map(0)) {
+				return false;
+			}
+
+			Initialize();
+			return true;
+		}
+
+		/**
+		 * Process-private table, used by the driver when the named segment can't be created so the
+		 * IPC path keeps working.
+		 */
+		bool CreateAnonymous() {
+			Close();
+
+			if (!Map(MAP_ANONYMOUS)) {
+				return false;
+			}
+
+			Initialize();
+			return true;
+		}
+
+		bool Open(const char* segment_name) {
+			Close();
+
+			fd = shm_open(segment_name, O_RDWR, 0666);
+			if (fd < 0) {
+				return false;
+			}
+
+			return Map(0);
+		}
+
+		uint64_t Version() const {
+			return pData->version.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * Copies the current table, calls modify on the copy and publishes it as the next version.
+		 */
+		template<typename F>
+		void Publish(F modify) {
+			if (!pData || !LockWriter()) return;
+
+			uint64_t version = pData->version.load(std::memory_order_relaxed);
+			Buffer &current = pData->buffers[version & 1];
+			Buffer &next = pData->buffers[(version + 1) & 1];
+
+			next.seq.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			memcpy((void *) &next.table, (const void *) &current.table, sizeof(DeviceTransformTable));
+			modify(next.table);
+
+			next.seq.fetch_add(1, std::memory_order_release);
+			pData->version.store(version + 1, std::memory_order_release);
+
+			UnlockWriter();
+		}
+
+		/**
+		 * Reads one device's entry of the table published as version. Returns false if a writer
+		 * was overwriting that buffer, in which case the caller should retry later.
+		 */
+		bool ReadTransform(uint64_t version, uint32_t openVRID, DeviceTransformState &out) const {
+			const Buffer &buffer = pData->buffers[version & 1];
+
+			uint32_t seq = buffer.seq.load(std::memory_order_acquire);
+			if (seq & 1) return false;
+
+			memcpy((void *) &out, (const void *) &buffer.table.transforms[openVRID], sizeof(out));
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return buffer.seq.load(std::memory_order_relaxed) == seq;
+		}
+
+		bool ReadAlignmentSpeedParams(uint64_t version, AlignmentSpeedParams &out) const {
+			const Buffer &buffer = pData->buffers[version & 1];
+
+			uint32_t seq = buffer.seq.load(std::memory_order_acquire);
+			if (seq & 1) return false;
+
+			memcpy((void *) &out, (const void *) &buffer.table.alignmentSpeedParams, sizeof(out));
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return buffer.seq.load(std::memory_order_relaxed) == seq;
+		}
+
+		/**
+		 * Copies the whole current table, retrying until a consistent snapshot is read.
+		 */
+		void ReadTable(DeviceTransformTable &out) const {
+			for (;;) {
+				uint64_t version = Version();
+				const Buffer &buffer = pData->buffers[version & 1];
+
+				uint32_t seq = buffer.seq.load(std::memory_order_acquire);
+				if (seq & 1) {
+					sched_yield();
+					continue;
+				}
+
+				memcpy((void *) &out, (const void *) &buffer.table, sizeof(out));
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (buffer.seq.load(std::memory_order_relaxed) == seq) return;
+			}
+		}
+	};
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+// Times the driver's pose hook for one enabled device against a copy of the hook from before
+// transforms were pre-baked, which mapped the translation through a quaternion sandwich.
+//
+//   bench-pose-hook [poses]
+
+#include "ServerTrackedDeviceProvider.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+struct PoseHookBench
+{
+	ServerTrackedDeviceProvider provider;
+
+	// The table Init would create, minus the shared segment other processes could see
+	bool Setup(const protocol::SetDeviceTransform &transform)
+	{
+		if (!provider.transformShmem.CreateAnonymous())
+			return false;
+		provider.SetDeviceTransform(transform);
+		return true;
+	}
+
+	protocol::DeviceTransformShmem &Table() { return provider.transformShmem; }
+	void WritePose(uint32_t openVRID, const vr::DriverPose_t &pose) { provider.poseShmem.WritePose(openVRID, pose); }
+
+	bool Hook(uint32_t openVRID, vr::DriverPose_t &pose)
+	{
+		return provider.HandleDevicePoseUpdated(openVRID, pose);
+	}
+};
+
+static vr::HmdQuaternion_t Multiply(const vr::HmdQuaternion_t &lhs, const vr::HmdQuaternion_t &rhs)
+{
+	return {
+		(lhs.w * rhs.w) - (lhs.x * rhs.x) - (lhs.y * rhs.y) - (lhs.z * rhs.z),
+		(lhs.w * rhs.x) + (lhs.x * rhs.w) + (lhs.y * rhs.z) - (lhs.z * rhs.y),
+		(lhs.w * rhs.y) + (lhs.y * rhs.w) + (lhs.z * rhs.x) - (lhs.x * rhs.z),
+		(lhs.w * rhs.z) + (lhs.z * rhs.w) + (lhs.x * rhs.y) - (lhs.y * rhs.x)
+	};
+}
+
+// The hook as it was before pre-baking: the same shared memory write and checks, but the
+// translation goes through a quaternion sandwich. Kept out of line like the real hook.
+struct LegacyHook
+{
+	PoseHookBench &bench;
+	uint64_t version = UINT64_MAX;
+	protocol::DeviceTransformState tf = {};
+	uint32_t quashedUpdates = 0;
+
+	__attribute__((noinline)) bool Hook(uint32_t openVRID, vr::DriverPose_t &pose)
+	{
+		bench.WritePose(openVRID, pose);
+
+		if (openVRID >= vr::k_unMaxTrackedDeviceCount)
+			return true;
+
+		auto &table = bench.Table();
+		uint64_t current = table.Version();
+		if (current != version && table.ReadTransform(current, openVRID, tf))
+			version = current;
+
+		if (tf.quash)
+		{
+			if (tf.quashForwardInterval == 0 || ++quashedUpdates < tf.quashForwardInterval)
+				return false;
+			quashedUpdates = 0;
+		}
+
+		if (!tf.enabled)
+			return true;
+
+		pose.qWorldFromDriverRotation = Multiply(tf.rotation, pose.qWorldFromDriverRotation);
+
+		pose.vecPosition[0] *= tf.scale;
+		pose.vecPosition[1] *= tf.scale;
+		pose.vecPosition[2] *= tf.scale;
+
+		const double *v = pose.vecWorldFromDriverTranslation;
+		vr::HmdQuaternion_t vectorQuat = { 0.0, v[0], v[1], v[2] };
+		vr::HmdQuaternion_t conjugate = { tf.rotation.w, -tf.rotation.x, -tf.rotation.y, -tf.rotation.z };
+		auto rotated = Multiply(Multiply(tf.rotation, vectorQuat), conjugate);
+		pose.vecWorldFromDriverTranslation[0] = rotated.x + tf.translation.v[0];
+		pose.vecWorldFromDriverTranslation[1] = rotated.y + tf.translation.v[1];
+		pose.vecWorldFromDriverTranslation[2] = rotated.z + tf.translation.v[2];
+		return true;
+	}
+};
+
+static vr::DriverPose_t BasePose()
+{
+	vr::DriverPose_t pose = {};
+	pose.qWorldFromDriverRotation = { 1.0, 0.0, 0.0, 0.0 };
+	pose.qDriverFromHeadRotation = { 1.0, 0.0, 0.0, 0.0 };
+	pose.vecPosition[0] = 1.0;
+	pose.vecWorldFromDriverTranslation[0] = 0.25;
+	pose.vecWorldFromDriverTranslation[1] = 0.5;
+	pose.vecWorldFromDriverTranslation[2] = -0.75;
+	return pose;
+}
+
+// Runs hook over count poses that differ in position, returning ns per pose. The checksum keeps
+// the results alive.
+template<typename H>
+static double Time(H &hook, size_t count, double &checksum)
+{
+	const vr::DriverPose_t base = BasePose();
+	checksum = 0.0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		vr::DriverPose_t pose = base;
+		pose.vecPosition[2] = i * 1e-9;
+		checksum += hook.Hook(1, pose) + pose.vecWorldFromDriverTranslation[0] + pose.qWorldFromDriverRotation.y;
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / count;
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 20000000;
+
+	// 45 degrees about Y, with a translation and a slight scale. The sandwich scales by the
+	// quaternion's squared norm and the baked matrix doesn't, so it has to be unit to compare.
+	vr::HmdQuaternion_t rotation = { std::cos(M_PI / 8), 0.0, std::sin(M_PI / 8), 0.0 };
+	protocol::SetDeviceTransform transform(1, true, vr::HmdVector3d_t{ 0.1, 0.2, 0.3 }, rotation, 1.01);
+
+	PoseHookBench current;
+	if (!current.Setup(transform))
+	{
+		fprintf(stderr, "Could not allocate a transform table\n");
+		return 1;
+	}
+	LegacyHook legacy{ current };
+
+	// Both must map a pose identically before their timings mean anything
+	vr::DriverPose_t a = BasePose(), b = BasePose();
+	current.Hook(1, a);
+	legacy.Hook(1, b);
+	double maxError = 0.0;
+	for (int i = 0; i < 3; i++)
+		maxError = std::fmax(maxError, std::fabs(a.vecWorldFromDriverTranslation[i] - b.vecWorldFromDriverTranslation[i]));
+	if (maxError > 1e-12)
+	{
+		fprintf(stderr, "Pre-baked hook differs from the quaternion sandwich by %g\n", maxError);
+		return 1;
+	}
+
+	double legacySum, currentSum;
+	double legacyNs = Time(legacy, count, legacySum);
+	double currentNs = Time(current, count, currentSum);
+
+	printf("%zu poses, one enabled device\n", count);
+	printf("  quaternion sandwich: %6.2f ns/pose\n", legacyNs);
+	printf("  pre-baked mat-vec:   %6.2f ns/pose\n", currentNs);
+	printf("  checksums: %.17g %.17g\n", legacySum, currentSum);
+	return 0;
+}
@@ -0,0 +1,267 @@
+// Times reading and writing the profile with the streaming JSON code against the picojson code it
+// replaced, for chaperone geometries of increasing size.
+//
+//   bench-profile-json [quads...]
+
+// ParseProfile and WriteProfile are private to the translation unit
+#include "../OpenVR-SpaceCalibrator/Configuration.cpp"
+
+#include "../lib/picojson.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+
+CalibrationContext CalCtx;
+
+double CalibrationClock()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+void RecheckStoredProfile() { }
+
+namespace legacy
+{
+	static picojson::array FloatArray(const float *buf, int numFloats)
+	{
+		picojson::array arr;
+
+		for (int i = 0; i < numFloats; i++)
+			arr.push_back(picojson::value(double(buf[i])));
+
+		return arr;
+	}
+
+	static void LoadFloatArray(const picojson::value &obj, float *buf, size_t numFloats)
+	{
+		if (!obj.is<picojson::array>())
+			throw std::runtime_error("expected array, got " + obj.to_str());
+
+		auto &arr = obj.get<picojson::array>();
+		if (arr.size() != numFloats)
+			throw std::runtime_error("wrong buffer size");
+
+		for (size_t i = 0; i < numFloats; i++)
+			buf[i] = (float) arr[i].get<double>();
+	}
+
+	static void ParseProfile(CalibrationContext &ctx, std::istream &stream)
+	{
+		picojson::value v;
+		std::string err = picojson::parse(v, stream);
+		if (!err.empty())
+			throw std::runtime_error(err);
+
+		auto arr = v.get<picojson::array>();
+		if (arr.size() < 1)
+			throw std::runtime_error("no profiles in file");
+
+		auto obj = arr[0].get<picojson::object>();
+
+		ctx.referenceTrackingSystem = obj["reference_tracking_system"].get<std::string>();
+		ctx.targetTrackingSystem = obj["target_tracking_system"].get<std::string>();
+		ctx.calibratedRotation(0) = obj["roll"].get<double>();
+		ctx.calibratedRotation(1) = obj["yaw"].get<double>();
+		ctx.calibratedRotation(2) = obj["pitch"].get<double>();
+		ctx.calibratedTranslation(0) = obj["x"].get<double>();
+		ctx.calibratedTranslation(1) = obj["y"].get<double>();
+		ctx.calibratedTranslation(2) = obj["z"].get<double>();
+
+		if (obj["scale"].is<double>())
+			ctx.calibratedScale = obj["scale"].get<double>();
+		else
+			ctx.calibratedScale = 1.0;
+
+		if (obj["calibration_speed"].is<double>())
+			ctx.calibrationSpeed = (CalibrationContext::Speed)(int) obj["calibration_speed"].get<double>();
+		if (obj["quash_target_forward_interval"].is<double>())
+			ctx.quashTargetForwardInterval = (int) obj["quash_target_forward_interval"].get<double>();
+
+		if (obj["chaperone"].is<picojson::object>())
+		{
+			auto chaperone = obj["chaperone"].get<picojson::object>();
+			ctx.chaperone.autoApply = chaperone["auto_apply"].get<bool>();
+
+			LoadFloatArray(chaperone["play_space_size"], ctx.chaperone.playSpaceSize.v, 2);
+
+			LoadFloatArray(
+				chaperone["standing_center"],
+				(float *) ctx.chaperone.standingCenter.m,
+				sizeof(ctx.chaperone.standingCenter.m) / sizeof(float)
+			);
+
+			if (!chaperone["geometry"].is<picojson::array>())
+				throw std::runtime_error("chaperone geometry is not an array");
+
+			auto &geometry = chaperone["geometry"].get<picojson::array>();
+
+			if (geometry.size() > 0)
+			{
+				ctx.chaperone.geometry.resize(geometry.size() * sizeof(float) / sizeof(ctx.chaperone.geometry[0]));
+				LoadFloatArray(chaperone["geometry"], (float *) ctx.chaperone.geometry.data(), geometry.size());
+
+				ctx.chaperone.valid = true;
+			}
+		}
+
+		ctx.validProfile = true;
+	}
+
+	static void WriteProfile(CalibrationContext &ctx, std::ostream &out)
+	{
+		picojson::object profile;
+		profile["reference_tracking_system"].set<std::string>(ctx.referenceTrackingSystem);
+		profile["target_tracking_system"].set<std::string>(ctx.targetTrackingSystem);
+		profile["roll"].set<double>(ctx.calibratedRotation(0));
+		profile["yaw"].set<double>(ctx.calibratedRotation(1));
+		profile["pitch"].set<double>(ctx.calibratedRotation(2));
+		profile["x"].set<double>(ctx.calibratedTranslation(0));
+		profile["y"].set<double>(ctx.calibratedTranslation(1));
+		profile["z"].set<double>(ctx.calibratedTranslation(2));
+		profile["scale"].set<double>(ctx.calibratedScale);
+
+		double speed = (int) ctx.calibrationSpeed;
+		profile["calibration_speed"].set<double>(speed);
+		double forwardInterval = ctx.quashTargetForwardInterval;
+		profile["quash_target_forward_interval"].set<double>(forwardInterval);
+
+		if (ctx.chaperone.valid)
+		{
+			picojson::object chaperone;
+			chaperone["auto_apply"].set<bool>(ctx.chaperone.autoApply);
+			chaperone["play_space_size"].set<picojson::array>(FloatArray(ctx.chaperone.playSpaceSize.v, 2));
+
+			chaperone["standing_center"].set<picojson::array>(FloatArray(
+				(float *) ctx.chaperone.standingCenter.m,
+				sizeof(ctx.chaperone.standingCenter.m) / sizeof(float)
+			));
+
+			chaperone["geometry"].set<picojson::array>(FloatArray(
+				(float *) ctx.chaperone.geometry.data(),
+				sizeof(ctx.chaperone.geometry[0]) / sizeof(float) * ctx.chaperone.geometry.size()
+			));
+
+			profile["chaperone"].set<picojson::object>(chaperone);
+		}
+
+		picojson::value profileV;
+		profileV.set<picojson::object>(profile);
+
+		picojson::array profiles;
+		profiles.push_back(profileV);
+
+		picojson::value profilesV;
+		profilesV.set<picojson::array>(profiles);
+
+		out << profilesV.serialize(true);
+	}
+}
+
+static void Fill(CalibrationContext &ctx, size_t quads)
+{
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> coordinate(-5.0f, 5.0f);
+
+	ctx.validProfile = true;
+	ctx.referenceTrackingSystem = "lighthouse";
+	ctx.targetTrackingSystem = "oculus";
+	ctx.calibratedRotation = Eigen::Vector3d(1.5, -2.25, 0.1);
+	ctx.calibratedTranslation = Eigen::Vector3d(10.123456789, -3.0, 0.000001);
+	ctx.calibratedScale = 1.0001;
+	ctx.quashTargetForwardInterval = 7;
+
+	ctx.chaperone.valid = true;
+	ctx.chaperone.autoApply = true;
+	ctx.chaperone.playSpaceSize = { 3.5f, 2.25f };
+	for (auto &value : ctx.chaperone.standingCenter.m)
+		for (auto &element : value)
+			element = coordinate(rng);
+	ctx.chaperone.geometry.resize(quads);
+	for (auto &quad : ctx.chaperone.geometry)
+		for (auto &corner : quad.vCorners)
+			for (auto &element : corner.v)
+				element = coordinate(rng);
+}
+
+// The members both implementations read and write
+static bool Same(const CalibrationContext &a, const CalibrationContext &b)
+{
+	return a.referenceTrackingSystem == b.referenceTrackingSystem && a.targetTrackingSystem == b.targetTrackingSystem
+		&& a.calibratedRotation == b.calibratedRotation && a.calibratedTranslation == b.calibratedTranslation
+		&& a.calibratedScale == b.calibratedScale && a.quashTargetForwardInterval == b.quashTargetForwardInterval
+		&& a.chaperone.autoApply == b.chaperone.autoApply
+		&& a.chaperone.playSpaceSize.v[0] == b.chaperone.playSpaceSize.v[0] && a.chaperone.playSpaceSize.v[1] == b.chaperone.playSpaceSize.v[1]
+		&& !memcmp(&a.chaperone.standingCenter, &b.chaperone.standingCenter, sizeof(a.chaperone.standingCenter))
+		&& a.chaperone.geometry.size() == b.chaperone.geometry.size()
+		&& !memcmp(a.chaperone.geometry.data(), b.chaperone.geometry.data(), a.chaperone.geometry.size() * sizeof(vr::HmdQuad_t));
+}
+
+// Best of several runs, in milliseconds
+template<typename F>
+static double Time(F run)
+{
+	double best = INFINITY;
+	for (int i = 0; i < 5; i++)
+	{
+		double start = CalibrationClock();
+		run();
+		best = std::min(best, (CalibrationClock() - start) * 1e3);
+	}
+	return best;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<size_t> sizes = { 100, 10000, 100000 };
+	if (argc > 1)
+	{
+		sizes.clear();
+		for (int i = 1; i < argc; i++)
+			sizes.push_back(strtoull(argv[i], nullptr, 10));
+	}
+
+	printf("%8s %12s %12s %12s %12s %12s\n", "quads", "bytes", "old write", "new write", "old read", "new read");
+	for (size_t quads : sizes)
+	{
+		CalibrationContext source;
+		Fill(source, quads);
+
+		std::string oldText, newText;
+		double oldWrite = Time([&] {
+			std::ostringstream out;
+			legacy::WriteProfile(source, out);
+			oldText = out.str();
+		});
+		double newWrite = Time([&] {
+			newText.clear();
+			WriteProfile(source, newText);
+		});
+
+		// Reading replaces everything Same compares, so the contexts can be reused between runs
+		CalibrationContext oldRead, newRead;
+		double oldReadMs = Time([&] {
+			std::istringstream in(newText);
+			legacy::ParseProfile(oldRead, in);
+		});
+		double newReadMs = Time([&] {
+			ProfileStore store;
+			ParseProfile(newRead, store, newText);
+		});
+
+		// Each must read back what the other wrote, or the timings compare different work
+		CalibrationContext newFromOld;
+		ProfileStore store;
+		ParseProfile(newFromOld, store, oldText);
+		if (!Same(source, oldRead) || !Same(source, newRead) || !Same(source, newFromOld))
+		{
+			fprintf(stderr, "%zu quads: profiles differ after a round trip\n", quads);
+			return 1;
+		}
+
+		printf("%8zu %12zu %9.2f ms %9.2f ms %9.2f ms %9.2f ms\n", quads, newText.size(), oldWrite, newWrite, oldReadMs, newReadMs);
+	}
+	return 0;
+}